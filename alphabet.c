@@ -0,0 +1,278 @@
+/** 
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2013, Valera Leontyev.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *  - this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *  - this list of conditions and the following disclaimer in the documentation
+ *  - and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of the Valera Leontyev nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "alphabet.h"
+#include "libsuggest.h"
+
+#define ALPHABET_REPLACEMENT 0xFFFD
+
+// Folding
+
+static uint32_t alphabet_fold_latin1 (uint32_t c)
+{
+	if ((c >= 'A' && c <= 'Z') || (c >= 0xC0 && c <= 0xDE && c != 0xD7)) {
+		return c + 0x20;
+	}
+	return c;
+}
+
+static uint32_t alphabet_fold_cp1251 (uint32_t c)
+{
+	// Capitals outside the two regular ranges, with their small letters
+	static const unsigned char pairs[][2] = {
+		{ 0x80, 0x90 }, { 0x81, 0x83 }, { 0x8A, 0x9A }, { 0x8C, 0x9C }, { 0x8D, 0x9D }, { 0x8E, 0x9E },
+		{ 0x8F, 0x9F }, { 0xA1, 0xA2 }, { 0xA3, 0xBC }, { 0xA5, 0xB4 }, { 0xA8, 0xB8 }, { 0xAA, 0xBA },
+		{ 0xAF, 0xBF }, { 0xB2, 0xB3 }, { 0xBD, 0xBE }
+	};
+	if ((c >= 'A' && c <= 'Z') || (c >= 0xC0 && c <= 0xDF)) {
+		return c + 0x20;
+	}
+	for (size_t i = 0; i < sizeof(pairs) / sizeof(pairs[0]); i++) {
+		if (c == pairs[i][0]) {
+			return pairs[i][1];
+		}
+	}
+	return c;
+}
+
+// Simple case folding of the Latin, Greek and Cyrillic letters
+static uint32_t alphabet_fold_unicode (uint32_t c)
+{
+	if (c < 0x100) {
+		return alphabet_fold_latin1(c);
+	}
+	if (c == 0x130) {
+		return 'i';
+	}
+	if ((c <= 0x137 || (c >= 0x14A && c <= 0x177)) && !(c & 1)) {
+		return c + 1;
+	}
+	if (((c >= 0x139 && c <= 0x148) || (c >= 0x179 && c <= 0x17E)) && (c & 1)) {
+		return c + 1;
+	}
+	if (c == 0x178) {
+		return 0xFF;
+	}
+	if (c == 0x386) {
+		return 0x3AC;
+	}
+	if (c >= 0x388 && c <= 0x38A) {
+		return c + 0x25;
+	}
+	if (c == 0x38C) {
+		return 0x3CC;
+	}
+	if (c == 0x38E || c == 0x38F) {
+		return c + 0x3F;
+	}
+	if (c >= 0x391 && c <= 0x3A9 && c != 0x3A2) {
+		return c + 0x20;
+	}
+	if (c >= 0x400 && c <= 0x40F) {
+		return c + 0x50;
+	}
+	if (c >= 0x410 && c <= 0x42F) {
+		return c + 0x20;
+	}
+	if (((c >= 0x460 && c <= 0x481) || (c >= 0x48A && c <= 0x4BF)) && !(c & 1)) {
+		return c + 1;
+	}
+	return c;
+}
+
+// Decoding
+
+// Next character of text, *used set to the bytes it takes
+static uint32_t alphabet_next (int encoding, const unsigned char *text, size_t length, size_t *used)
+{
+	*used = 1;
+	if (encoding == ALPHABET_LATIN1) {
+		return alphabet_fold_latin1(text[0]);
+	}
+	if (encoding == ALPHABET_CP1251) {
+		return alphabet_fold_cp1251(text[0]);
+	}
+
+	uint32_t c = text[0];
+	if (c < 0x80) {
+		return alphabet_fold_latin1(c);
+	}
+	size_t size = c >= 0xC2 && c <= 0xDF ? 2 : c >= 0xE0 && c <= 0xEF ? 3 : c >= 0xF0 && c <= 0xF4 ? 4 : 0;
+	if (!size || size > length) {
+		return ALPHABET_REPLACEMENT;
+	}
+	c &= 0x7F >> size;
+	for (size_t i = 1; i < size; i++) {
+		if ((text[i] & 0xC0) != 0x80) {
+			return ALPHABET_REPLACEMENT;
+		}
+		c = c << 6 | (text[i] & 0x3F);
+	}
+	// Overlong forms, surrogates and code points past U+10FFFF
+	if ((size == 3 && c < 0x800) || (size == 4 && (c < 0x10000 || c > 0x10FFFF)) || (c >= 0xD800 && c <= 0xDFFF)) {
+		return ALPHABET_REPLACEMENT;
+	}
+	*used = size;
+	return alphabet_fold_unicode(c);
+}
+
+int alphabet_encoding (const char *name)
+{
+	if (!strcmp(name, "latin1")) {
+		return ALPHABET_LATIN1;
+	}
+	if (!strcmp(name, "cp1251")) {
+		return ALPHABET_CP1251;
+	}
+	if (!strcmp(name, "utf8")) {
+		return ALPHABET_UTF8;
+	}
+	return -1;
+}
+
+size_t alphabet_decode (int encoding, const char *text, size_t length, uint32_t *chars, size_t max)
+{
+	size_t count = 0;
+	for (size_t i = 0, used; i < length; i += used) {
+		uint32_t c = alphabet_next(encoding, (const unsigned char *)text + i, length - i, &used);
+		if (count < max) {
+			chars[count] = c;
+		}
+		count++;
+	}
+	return count;
+}
+
+size_t alphabet_encode (int encoding, const uint32_t *chars, size_t count, char *text)
+{
+	unsigned char *out = (unsigned char *)text;
+	for (size_t i = 0; i < count; i++) {
+		uint32_t c = chars[i];
+		if (encoding != ALPHABET_UTF8 || c < 0x80) {
+			*out++ = c;
+		} else if (c < 0x800) {
+			*out++ = 0xC0 | c >> 6;
+			*out++ = 0x80 | (c & 0x3F);
+		} else if (c < 0x10000) {
+			*out++ = 0xE0 | c >> 12;
+			*out++ = 0x80 | (c >> 6 & 0x3F);
+			*out++ = 0x80 | (c & 0x3F);
+		} else {
+			*out++ = 0xF0 | c >> 18;
+			*out++ = 0x80 | (c >> 12 & 0x3F);
+			*out++ = 0x80 | (c >> 6 & 0x3F);
+			*out++ = 0x80 | (c & 0x3F);
+		}
+	}
+	return out - (unsigned char *)text;
+}
+
+// Map
+
+static int alphabet_point_compare (const void *a, const void *b)
+{
+	uint64_t left = *(const uint64_t *)a, right = *(const uint64_t *)b;
+	return left < right ? -1 : left > right;
+}
+
+int alphabet_map_init (struct AlphabetMap *map, int encoding, const uint32_t *symbols, size_t count)
+{
+	memset(map, 0, sizeof(*map));
+	map->encoding = encoding;
+	if (count > ALPHABET_MAX_SYMBOLS) {
+		return SUGGEST_ERR_FORMAT;
+	}
+
+	if (encoding != ALPHABET_UTF8) {
+		// Every byte folds to one character of the code page
+		memset(map->bytes, ALPHABET_UNKNOWN, sizeof(map->bytes));
+		for (unsigned c = 0; c < 256; c++) {
+			uint32_t folded = encoding == ALPHABET_LATIN1 ? alphabet_fold_latin1(c) : alphabet_fold_cp1251(c);
+			for (size_t i = 0; i < count; i++) {
+				if (symbols[i] == folded) {
+					map->bytes[c] = i + 1;
+					break;
+				}
+			}
+		}
+		return SUGGEST_OK;
+	}
+
+	if (!(map->points = malloc((count ? count : 1) * sizeof(*map->points)))) {
+		return SUGGEST_ERR_NOMEM;
+	}
+	for (size_t i = 0; i < count; i++) {
+		map->points[i] = (uint64_t)symbols[i] << 8 | (i + 1);
+	}
+	qsort(map->points, count, sizeof(*map->points), alphabet_point_compare);
+	map->count = count;
+	return SUGGEST_OK;
+}
+
+void alphabet_map_free (struct AlphabetMap *map)
+{
+	free(map->points);
+	map->points = NULL;
+}
+
+size_t alphabet_map (const struct AlphabetMap *map, const char *text, size_t length, char *codes)
+{
+	size_t count = 0;
+	for (size_t i = 0, used; i < length; i += used, count++) {
+		if (count == UINT8_MAX) {
+			return (size_t)-1;
+		}
+		if (map->encoding != ALPHABET_UTF8) {
+			used = 1;
+			codes[count] = map->bytes[(unsigned char)text[i]];
+			continue;
+		}
+
+		uint64_t key = (uint64_t)alphabet_next(map->encoding, (const unsigned char *)text + i, length - i, &used) << 8;
+		size_t low = 0, high = map->count;
+		while (low < high) {
+			size_t middle = low + (high - low) / 2;
+			if (map->points[middle] >> 8 < key >> 8) {
+				low = middle + 1;
+			} else {
+				high = middle;
+			}
+		}
+		codes[count] = low < map->count && map->points[low] >> 8 == key >> 8
+			? (char)(map->points[low] & 0xFF) : (char)ALPHABET_UNKNOWN;
+	}
+	return count;
+}
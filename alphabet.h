@@ -0,0 +1,90 @@
+/** 
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2013, Valera Leontyev.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *  - this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *  - this list of conditions and the following disclaimer in the documentation
+ *  - and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of the Valera Leontyev nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef ALPHABET_H_INCLUDED
+#define ALPHABET_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Alphabets: a dictionary built with one stores every word as a string of
+ * dense symbol codes instead of its bytes. The text is decoded (one byte per
+ * character for single-byte code pages, code points for UTF-8), case folded,
+ * and every distinct character gets a code from 1 up, the most frequent
+ * characters first, so that one multibyte character is one symbol for the
+ * distance and the 63 most frequent ones get bits of their own in the word
+ * masks. Queries are remapped the same way once, before the scan.
+ */
+
+#define ALPHABET_BYTES 0  // no remapping: words are compared byte by byte
+#define ALPHABET_LATIN1 1
+#define ALPHABET_CP1251 2
+#define ALPHABET_UTF8 3
+
+#define ALPHABET_MAX_SYMBOLS 254 // codes 1 to 254, code 0 is never used
+#define ALPHABET_UNKNOWN 255     // code of the characters missing from the dictionary
+
+/* Encoding named name ("latin1", "cp1251" or "utf8"), -1 if unknown */
+int alphabet_encoding (const char *name);
+
+/* Decodes length bytes of text into case folded characters (bytes of the code
+ * page, or code points), at most max of them. Invalid UTF-8 bytes decode to
+ * U+FFFD. Returns the number of characters, which may exceed max.
+ */
+size_t alphabet_decode (int encoding, const char *text, size_t length, uint32_t *chars, size_t max);
+
+/* Writes the characters back as text, at most 4 bytes each. Returns the
+ * number of bytes written.
+ */
+size_t alphabet_encode (int encoding, const uint32_t *chars, size_t count, char *text);
+
+// Query side: character to code
+struct AlphabetMap {
+	int encoding;
+	uint8_t bytes[256];  // single-byte code pages: code of every byte
+	uint64_t *points;    // UTF-8: code point << 8 | code, sorted
+	size_t count;
+};
+
+/* Builds the map of the count characters of symbols (symbols[i] has code
+ * i + 1).
+ */
+int alphabet_map_init (struct AlphabetMap *map, int encoding, const uint32_t *symbols, size_t count);
+void alphabet_map_free (struct AlphabetMap *map);
+
+/* Remaps length bytes of text into codes, at most UINT8_MAX of them. Returns
+ * the number of codes, or (size_t)-1 when there would be more.
+ */
+size_t alphabet_map (const struct AlphabetMap *map, const char *text, size_t length, char *codes);
+
+#endif
@@ -0,0 +1,294 @@
+/** 
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2013, Valera Leontyev.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *  - this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *  - this list of conditions and the following disclaimer in the documentation
+ *  - and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of the Valera Leontyev nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "cache.h"
+
+#define FNV_OFFSET 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+static uint64_t fnv1a (uint64_t hash, const void *data, size_t size)
+{
+	const unsigned char *bytes = data;
+	for (size_t i = 0; i < size; i++) {
+		hash ^= bytes[i];
+		hash *= FNV_PRIME;
+	}
+	return hash;
+}
+
+static int cache_lock (struct Cache *cache, short type)
+{
+	struct flock lock;
+	memset(&lock, 0, sizeof(lock));
+	lock.l_type = type;
+	lock.l_whence = SEEK_SET;
+	int r;
+	while ((r = fcntl(cache->fd, F_SETLKW, &lock)) == -1 && errno == EINTR);
+	return r;
+}
+
+static struct CacheSlot *cache_slot (struct Cache *cache, uint32_t index)
+{
+	return (struct CacheSlot *)(cache->slots + (size_t)index * CACHE_SLOT_SIZE);
+}
+
+static uint64_t cache_key_hash (uint64_t dict_hash, const char *word, size_t word_length,
+								short max_length_diff, short max_lev_diff)
+{
+	int16_t params[2] = { max_length_diff, max_lev_diff };
+	uint64_t hash = fnv1a(FNV_OFFSET, &dict_hash, sizeof(dict_hash));
+	hash = fnv1a(hash, params, sizeof(params));
+	hash = fnv1a(hash, word, word_length);
+	return hash ? hash : 1;
+}
+
+static int cache_slot_matches (struct CacheSlot *slot, uint64_t key_hash, uint64_t dict_hash, const char *word,
+							   size_t word_length, short max_length_diff, short max_lev_diff)
+{
+	return slot->key_hash == key_hash && slot->dict_hash == dict_hash
+		&& slot->max_length_diff == max_length_diff && slot->max_lev_diff == max_lev_diff
+		&& slot->word_length == word_length && !memcmp(slot->data, word, word_length);
+}
+
+int cache_open (struct Cache *cache, const char *filename, uint32_t slot_count)
+{
+	cache->fd = open(filename, O_RDWR | O_CREAT, 0644);
+	if (cache->fd == -1) {
+		return -1;
+	}
+
+	if (cache_lock(cache, F_WRLCK) == -1) {
+		goto fail;
+	}
+
+	struct stat sb;
+	if (fstat(cache->fd, &sb) == -1) {
+		goto fail;
+	}
+
+	struct CacheHeader header;
+	if (sb.st_size == 0) {
+		if (slot_count < CACHE_WAYS) {
+			slot_count = CACHE_WAYS;
+		}
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+		header.version = CACHE_VERSION;
+		header.slot_size = CACHE_SLOT_SIZE;
+		header.slot_count = slot_count;
+		// Slots are left as holes, a zero key marks them empty
+		if (ftruncate(cache->fd, CACHE_SLOT_SIZE + (off_t)slot_count * CACHE_SLOT_SIZE) == -1
+			|| pwrite(cache->fd, &header, sizeof(header), 0) != sizeof(header)) {
+			goto fail;
+		}
+	} else if (pread(cache->fd, &header, sizeof(header), 0) != sizeof(header)
+			   || memcmp(header.magic, CACHE_MAGIC, sizeof(header.magic))
+			   || header.version != CACHE_VERSION || header.slot_size != CACHE_SLOT_SIZE
+			   || sb.st_size < CACHE_SLOT_SIZE + (off_t)header.slot_count * CACHE_SLOT_SIZE) {
+		errno = EINVAL;
+		goto fail;
+	}
+
+	cache->map_size = CACHE_SLOT_SIZE + (size_t)header.slot_count * CACHE_SLOT_SIZE;
+	void *addr = mmap(NULL, cache->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, cache->fd, 0);
+	if (addr == MAP_FAILED) {
+		goto fail;
+	}
+	cache->header = addr;
+	cache->slots = (char *)addr + CACHE_SLOT_SIZE;
+
+	cache_lock(cache, F_UNLCK);
+	return 0;
+
+fail:
+	{
+		int saved_errno = errno;
+		close(cache->fd);
+		cache->fd = -1;
+		errno = saved_errno;
+	}
+	return -1;
+}
+
+void cache_close (struct Cache *cache)
+{
+	munmap(cache->header, cache->map_size);
+	close(cache->fd);
+	cache->fd = -1;
+}
+
+int cache_dict_hash (struct Cache *cache, const char *dict_filename, uint64_t *hash)
+{
+	struct stat sb;
+	if (stat(dict_filename, &sb) == -1) {
+		return -1;
+	}
+
+	struct CacheDictMemo memo;
+	memset(&memo, 0, sizeof(memo));
+	memo.dev = sb.st_dev;
+	memo.ino = sb.st_ino;
+	memo.size = sb.st_size;
+	memo.mtime_sec = sb.st_mtim.tv_sec;
+	memo.mtime_nsec = sb.st_mtim.tv_nsec;
+
+	cache_lock(cache, F_RDLCK);
+	for (int i = 0; i < CACHE_DICT_MEMO; i++) {
+		struct CacheDictMemo *m = &cache->header->memo[i];
+		if (m->hash && m->dev == memo.dev && m->ino == memo.ino && m->size == memo.size
+			&& m->mtime_sec == memo.mtime_sec && m->mtime_nsec == memo.mtime_nsec) {
+			*hash = m->hash;
+			cache_lock(cache, F_UNLCK);
+			return 0;
+		}
+	}
+	cache_lock(cache, F_UNLCK);
+
+	// Unknown dictionary: hash its content once and remember the result
+	int fd = open(dict_filename, O_RDONLY);
+	if (fd == -1) {
+		return -1;
+	}
+	memo.hash = fnv1a(FNV_OFFSET, &memo.size, sizeof(memo.size));
+	if (memo.size) {
+		void *addr = mmap(NULL, memo.size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (addr == MAP_FAILED) {
+			close(fd);
+			return -1;
+		}
+		memo.hash = fnv1a(memo.hash, addr, memo.size);
+		munmap(addr, memo.size);
+	}
+	close(fd);
+	if (!memo.hash) {
+		memo.hash = 1;
+	}
+
+	cache_lock(cache, F_WRLCK);
+	uint32_t next = cache->header->memo_next % CACHE_DICT_MEMO;
+	cache->header->memo[next] = memo;
+	cache->header->memo_next = next + 1;
+	cache_lock(cache, F_UNLCK);
+
+	*hash = memo.hash;
+	return 0;
+}
+
+int cache_lookup (struct Cache *cache, uint64_t dict_hash, const char *word, short max_length_diff,
+				  short max_lev_diff, char **value, size_t *value_length)
+{
+	size_t word_length = strlen(word);
+	uint64_t key_hash = cache_key_hash(dict_hash, word, word_length, max_length_diff, max_lev_diff);
+	uint32_t slot_count = cache->header->slot_count;
+	uint32_t first = key_hash % slot_count;
+	int found = 0;
+
+	cache_lock(cache, F_RDLCK);
+	for (uint32_t i = 0; i < CACHE_WAYS; i++) {
+		struct CacheSlot *slot = cache_slot(cache, (first + i) % slot_count);
+		if (cache_slot_matches(slot, key_hash, dict_hash, word, word_length, max_length_diff, max_lev_diff)) {
+			*value = malloc(slot->value_length + 1);
+			if (*value) {
+				memcpy(*value, slot->data + word_length, slot->value_length);
+				*value_length = slot->value_length;
+				__atomic_store_n(&slot->referenced, 1, __ATOMIC_RELAXED);
+				found = 1;
+			}
+			break;
+		}
+	}
+	cache_lock(cache, F_UNLCK);
+
+	return found;
+}
+
+void cache_store (struct Cache *cache, uint64_t dict_hash, const char *word, short max_length_diff,
+				  short max_lev_diff, const char *value, size_t value_length)
+{
+	size_t word_length = strlen(word);
+	if (word_length + value_length > CACHE_SLOT_CAPACITY) {
+		return;
+	}
+
+	uint64_t key_hash = cache_key_hash(dict_hash, word, word_length, max_length_diff, max_lev_diff);
+	uint32_t slot_count = cache->header->slot_count;
+	uint32_t first = key_hash % slot_count;
+
+	cache_lock(cache, F_WRLCK);
+
+	// Prefer the slot already holding the key, then an empty one, then the
+	// first slot of the window not referenced since the hand last passed it
+	struct CacheSlot *victim = NULL;
+	for (uint32_t i = 0; i < CACHE_WAYS && !victim; i++) {
+		struct CacheSlot *slot = cache_slot(cache, (first + i) % slot_count);
+		if (cache_slot_matches(slot, key_hash, dict_hash, word, word_length, max_length_diff, max_lev_diff)) {
+			victim = slot;
+		}
+	}
+	for (uint32_t i = 0; i < CACHE_WAYS && !victim; i++) {
+		struct CacheSlot *slot = cache_slot(cache, (first + i) % slot_count);
+		if (!slot->key_hash) {
+			victim = slot;
+		}
+	}
+	for (uint32_t i = 0; i <= CACHE_WAYS && !victim; i++) {
+		struct CacheSlot *slot = cache_slot(cache, (first + i % CACHE_WAYS) % slot_count);
+		if (slot->referenced) {
+			slot->referenced = 0;
+		} else {
+			victim = slot;
+		}
+	}
+
+	victim->key_hash = 0;
+	victim->dict_hash = dict_hash;
+	victim->max_length_diff = max_length_diff;
+	victim->max_lev_diff = max_lev_diff;
+	victim->word_length = word_length;
+	victim->value_length = value_length;
+	victim->referenced = 0;
+	memcpy(victim->data, word, word_length);
+	memcpy(victim->data + word_length, value, value_length);
+	__atomic_store_n(&victim->key_hash, key_hash, __ATOMIC_RELEASE);
+
+	cache_lock(cache, F_UNLCK);
+}
@@ -0,0 +1,123 @@
+/** 
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2013, Valera Leontyev.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *  - this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *  - this list of conditions and the following disclaimer in the documentation
+ *  - and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of the Valera Leontyev nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef CACHE_H_INCLUDED
+#define CACHE_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Persistent query result cache.
+ *
+ * The cache file is an mmapped open-addressing hash table of fixed size slots.
+ * A key is (dictionary content hash, word, max_length_diff, max_lev_diff),
+ * the value is the complete output produced for that query. Every key may live
+ * in one of CACHE_WAYS consecutive slots; when all of them are taken the
+ * victim is chosen by the CLOCK (second chance) rule over the window.
+ *
+ * Concurrent processes synchronize through fcntl() locks on the cache file:
+ * lookups hold a shared lock, stores hold an exclusive one, so a reader never
+ * sees a half-written slot.
+ */
+
+#define CACHE_MAGIC "SGCACHE1"
+#define CACHE_VERSION 1
+#define CACHE_SLOT_SIZE 4096
+#define CACHE_DEFAULT_SLOTS 4096
+#define CACHE_WAYS 8
+#define CACHE_DICT_MEMO 16
+
+struct CacheDictMemo {
+	uint64_t dev;
+	uint64_t ino;
+	uint64_t size;
+	int64_t mtime_sec;
+	int64_t mtime_nsec;
+	uint64_t hash;
+};
+
+struct CacheHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t slot_size;
+	uint32_t slot_count;
+	uint32_t memo_next;
+	struct CacheDictMemo memo[CACHE_DICT_MEMO];
+};
+
+struct CacheSlot {
+	uint64_t key_hash; // 0 marks an empty slot
+	uint64_t dict_hash;
+	int16_t max_length_diff;
+	int16_t max_lev_diff;
+	uint16_t word_length;
+	uint8_t referenced;
+	uint8_t reserved;
+	uint32_t value_length;
+	char data[]; // word bytes followed by value bytes
+};
+
+#define CACHE_SLOT_CAPACITY (CACHE_SLOT_SIZE - sizeof(struct CacheSlot))
+
+struct Cache {
+	int fd;
+	size_t map_size;
+	struct CacheHeader *header;
+	char *slots;
+};
+
+/* Opens (creating if needed) the cache file. slot_count is used only when
+ * the file is created. Returns 0 on success, -1 on failure with errno set.
+ */
+int cache_open (struct Cache *cache, const char *filename, uint32_t slot_count);
+void cache_close (struct Cache *cache);
+
+/* Returns the content hash of the dictionary file. The hash is memoized in the
+ * cache header by file identity (device, inode, size, mtime), so for a known
+ * dictionary only stat() is issued and the file itself is not read.
+ * Returns 0 on success, -1 on failure with errno set.
+ */
+int cache_dict_hash (struct Cache *cache, const char *dict_filename, uint64_t *hash);
+
+/* Looks the query up. On hit copies the value into a malloc()ed buffer, stores
+ * it into *value and *value_length and returns 1. On miss returns 0.
+ */
+int cache_lookup (struct Cache *cache, uint64_t dict_hash, const char *word, short max_length_diff,
+				  short max_lev_diff, char **value, size_t *value_length);
+
+/* Stores the query result. Values not fitting in a slot are silently skipped.
+ */
+void cache_store (struct Cache *cache, uint64_t dict_hash, const char *word, short max_length_diff,
+				  short max_lev_diff, const char *value, size_t value_length);
+
+#endif
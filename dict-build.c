@@ -38,99 +38,236 @@
 #include <getopt.h>
 #include <string.h>
 
-struct Word {
-	char *word;
-	struct Word *next;
+#include "libsuggest.h"
+#include "image.h"
+
+#define FORMAT_PADDED 0
+#define FORMAT_IMAGE 1
+#define FORMAT_COMPACT 2 // front-coded image
+
+struct Options {
+	uint8_t verbose;
+	uint8_t format;
+	uint32_t partition_words;
+	int shards;
+	const char *output_prefix;
+	int encoding;
 };
 
-#ifndef _INTTYPES_H
-typedef unsigned char uint8_t;
-#endif
-
-# if !(_SVID_SOURCE || _BSD_SOURCE || _XOPEN_SOURCE >= 500 || _XOPEN_SOURCE && _XOPEN_SOURCE_EXTENDED \
-           || _POSIX_C_SOURCE >= 200809L)
-char *strdup (const char *s) {
-	char *d = malloc (strlen (s) + 1);
-	if (d == NULL) return NULL;
-	strcpy (d,s);
-	return d;
-}
-# endif
+void read_opts (int argc, char **argv, struct Options *opts);
+int write_dict (FILE *stream, const struct WordList *list, const struct Options *opts);
+int write_padded (FILE *stream, const struct WordList *list);
 
 int main (int argc, char **argv) {
-	uint8_t verbose = 1;
+	struct Options opts;
+	opts.verbose = 1;
+	opts.format = FORMAT_PADDED;
+	opts.partition_words = IMAGE_PARTITION_WORDS;
+	opts.shards = 0;
+	opts.output_prefix = NULL;
+	opts.encoding = ALPHABET_BYTES;
+
+	read_opts(argc, argv, &opts);
+
+	struct WordList list;
+	int r = word_list_read(stdin, &list);
+	if (r != SUGGEST_OK) {
+		fprintf(stderr, "Cannot read words: %s\n", suggest_strerror(r));
+		return 1;
+	}
+
 	uint8_t max_word_length = 0;
-	
-	struct Word *first = NULL;
-	struct Word *last = NULL;
-	
-	const uint8_t buf_size = 250;
-	char buf[buf_size];
-	int line = 0;
-	while (fgets(buf, buf_size, stdin)) {
-		line++;
-		uint8_t string_length = (uint8_t)strlen(buf);
-		if (string_length == buf_size - 1 && buf[buf_size - 2] != 0x13)
-		{
-			fprintf(stderr, "Is string %d greater than 250 symbols? Aborting\n", line);
-			return 1;
-		} else {
-			if (verbose) {
-				buf[string_length - 1] = 0x0;
-				fprintf(stderr, "%s > ", buf);
-				fprintf(stderr, "%d\n", (int)strlen(buf));
-			}
-			
-			if (max_word_length < string_length - 1) {
-				max_word_length = string_length - 1;
-			}
-			
-			struct Word *new = (struct Word*)malloc(sizeof(struct Word));
-			if (!new) {
-				fprintf(stderr, "Out of memory at line %d\n", line);
-				return 1;
-			}
-			new->word = strdup(buf);
-			if (!new->word) {
-				fprintf(stderr, "Out of memory at line %d\n", line);
-				return 1;
-			}
-			
-			if (!first) {
-				first = last = new;
-			} else {
-				last->next = new;
-				last = new;
-			}
+	for (size_t i = 0; i < list.count; i++) {
+		if (opts.verbose) {
+			fprintf(stderr, "%.*s > %d\n", (int)list.lengths[i], list.words[i], (int)list.lengths[i]);
+		}
+		if (max_word_length < list.lengths[i]) {
+			max_word_length = list.lengths[i];
 		}
 	}
 	
-	if (verbose) {
+	if (opts.verbose) {
 		fprintf(stderr, "\nMax word length is %d\n", max_word_length);
 	}
-	
-	
+
 	// ---
 
-	if (!first) {
-		return 0;
+	if (!opts.shards) {
+		r = write_dict(stdout, &list, &opts);
+		if (r != SUGGEST_OK) {
+			fprintf(stderr, "Cannot write dictionary: %s\n", suggest_strerror(r));
+		}
+		word_list_free(&list);
+		return r != SUGGEST_OK;
+	}
+
+	// Shard i gets words i, i + shards, i + 2 * shards, ...
+	struct WordList shard;
+	shard.text = NULL;
+	shard.words = malloc((list.count / opts.shards + 1) * sizeof(*shard.words));
+	shard.lengths = malloc((list.count / opts.shards + 1) * sizeof(*shard.lengths));
+	shard.frequencies = malloc((list.count / opts.shards + 1) * sizeof(*shard.frequencies));
+	if (!shard.words || !shard.lengths || !shard.frequencies) {
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+	for (int i = 0; i < opts.shards && r == SUGGEST_OK; i++) {
+		shard.count = 0;
+		for (size_t j = i; j < list.count; j += opts.shards) {
+			shard.words[shard.count] = list.words[j];
+			shard.lengths[shard.count] = list.lengths[j];
+			shard.frequencies[shard.count] = list.frequencies[j];
+			shard.count++;
+		}
+
+		char file_name[strlen(opts.output_prefix) + 16];
+		sprintf(file_name, "%s.%d", opts.output_prefix, i);
+		FILE *stream = fopen(file_name, "wb");
+		if (!stream) {
+			perror(file_name);
+			return 1;
+		}
+		r = write_dict(stream, &shard, &opts);
+		if (fclose(stream) && r == SUGGEST_OK) {
+			r = SUGGEST_ERR_IO;
+		}
+		if (r != SUGGEST_OK) {
+			fprintf(stderr, "%s: %s\n", file_name, suggest_strerror(r));
+		} else if (opts.verbose) {
+			fprintf(stderr, "%s: %zu words\n", file_name, shard.count);
+		}
+	}
+	word_list_free(&shard);
+	word_list_free(&list);
+
+	return r != SUGGEST_OK;
+}
+
+int write_dict (FILE *stream, const struct WordList *list, const struct Options *opts)
+{
+	if (opts->format == FORMAT_PADDED) {
+		return write_padded(stream, list);
+	}
+
+	struct Image image;
+	int r = image_build(list, opts->partition_words, opts->encoding,
+						opts->format == FORMAT_COMPACT ? IMAGE_CODING_FRONT : IMAGE_CODING_PLAIN, &image);
+	if (r == SUGGEST_OK) {
+		r = image_write(&image, stream);
+		image_free(&image);
+	}
+	return r;
+}
+
+// Fixed size segments, read by suggest
+int write_padded (FILE *stream, const struct WordList *list)
+{
+	if (!list->count) {
+		return SUGGEST_OK;
+	}
+
+	uint8_t max_word_length = 0;
+	for (size_t i = 0; i < list->count; i++) {
+		if (max_word_length < list->lengths[i]) {
+			max_word_length = list->lengths[i];
+		}
+	}
+	if (max_word_length == UINT8_MAX) {
+		return SUGGEST_ERR_FORMAT;
 	}
-	
 	uint8_t real_segment_length = max_word_length + 1;
 	
-	fwrite(&real_segment_length, sizeof(uint8_t), 1, stdout);
+	fwrite(&real_segment_length, sizeof(uint8_t), 1, stream);
+
+	char segment[real_segment_length];
+	for (size_t i = 0; i < list->count; i++) {
+		memset(segment, 0, real_segment_length);
+		memcpy(segment, list->words[i], list->lengths[i]);
+		fwrite(segment, real_segment_length, 1, stream);
+	}
 	
-	struct Word *next = first;
-	while (next) {
-		uint8_t size = (uint8_t)strlen(next->word);
-		fwrite(next->word, size, 1, stdout);
-		for (int i = 0; i < real_segment_length - size; i++) {
-			fwrite("", 1, 1, stdout);
+	return ferror(stream) ? SUGGEST_ERR_IO : SUGGEST_OK;
+}
+
+void read_opts (int argc, char **argv, struct Options *opts)
+{
+	while (1)
+	{
+		static struct option long_options[] =
+		{
+			{"verbose",    required_argument, 0, 'v'},
+			{"format",     required_argument, 0, 'f'},
+			{"partition-words", required_argument, 0, 'w'},
+			{"shards",     required_argument, 0, 'n'},
+			{"output",     required_argument, 0, 'o'},
+			{"alphabet",   required_argument, 0, 'a'},
+			{"help",       no_argument,       0, 'h'},
+			{0, 0, 0, 0}
+		};
+
+		int option_index = 0;
+		int c = getopt_long(argc, argv, "v:f:w:n:o:a:h", long_options, &option_index);
+
+		if (c == -1)
+			break;
+
+		switch (c)
+		{
+			case 'v': /* --verbose */
+				opts->verbose = (uint8_t)atoi(optarg);
+				break;
+
+			case 'f': /* --format */
+				if (!strcmp(optarg, "padded")) {
+					opts->format = FORMAT_PADDED;
+				} else if (!strcmp(optarg, "image")) {
+					opts->format = FORMAT_IMAGE;
+				} else if (!strcmp(optarg, "compact")) {
+					opts->format = FORMAT_COMPACT;
+				} else {
+					fprintf(stderr, "Unknown format %s\n", optarg);
+					exit(1);
+				}
+				break;
+
+			case 'w': /* --partition-words */
+				opts->partition_words = (uint32_t)atoi(optarg);
+				break;
+
+			case 'n': /* --shards */
+				opts->shards = atoi(optarg);
+				break;
+
+			case 'o': /* --output */
+				opts->output_prefix = optarg;
+				break;
+
+			case 'a': /* --alphabet */
+				opts->encoding = alphabet_encoding(optarg);
+				if (opts->encoding < 0) {
+					fprintf(stderr, "Unknown alphabet %s\n", optarg);
+					exit(1);
+				}
+				break;
+
+			case 'h': /* --help */
+				printf("Usage: %s [-v verbose] [-f padded|image|compact] [-w partition_words] [-n shards -o output_prefix] [-a latin1|cp1251|utf8] < words | -h\n", argv[0]);
+				exit(0);
+				break;
+
+			case '?':
+				/* getopt_long already printed an error message. */
+				break;
+
+			default:
+				abort();
 		}
-		last = next;
-		next = next->next;
-		free(last);
 	}
-	
-	return 0;
+
+	if (!opts->partition_words || opts->shards < 0 || (opts->shards && !opts->output_prefix)
+		|| (opts->encoding != ALPHABET_BYTES && opts->format != FORMAT_IMAGE)) {
+		fprintf(stderr, "Invalid options\n");
+		printf("Usage: %s [-v verbose] [-f padded|image|compact] [-w partition_words] [-n shards -o output_prefix] [-a latin1|cp1251|utf8] < words | -h\n", argv[0]);
+		exit(1);
+	}
 }
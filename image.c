@@ -0,0 +1,1067 @@
+/** 
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2013, Valera Leontyev.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *  - this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *  - this list of conditions and the following disclaimer in the documentation
+ *  - and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of the Valera Leontyev nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+
+#include "image.h"
+#include "mph.h"
+#include "libsuggest.h"
+
+// Word list
+
+static int word_list_padded (const char *text, size_t size);
+
+int word_list_read (FILE *stream, struct WordList *list)
+{
+	memset(list, 0, sizeof(*list));
+
+	size_t size = 0, capacity = 1 << 16;
+	list->text = malloc(capacity);
+	if (!list->text) {
+		return SUGGEST_ERR_NOMEM;
+	}
+	size_t read_bytes;
+	while ((read_bytes = fread(list->text + size, 1, capacity - size, stream)) > 0) {
+		size += read_bytes;
+		if (size == capacity) {
+			char *grown = realloc(list->text, capacity *= 2);
+			if (!grown) {
+				word_list_free(list);
+				return SUGGEST_ERR_NOMEM;
+			}
+			list->text = grown;
+		}
+	}
+	if (ferror(stream)) {
+		word_list_free(list);
+		return SUGGEST_ERR_IO;
+	}
+
+	int padded = word_list_padded(list->text, size);
+	size_t segment_size = padded ? (uint8_t)list->text[0] : 0;
+	size_t lines = 1;
+	if (padded) {
+		lines = (size - 1) / segment_size;
+	} else {
+		for (size_t i = 0; i < size; i++) {
+			lines += list->text[i] == '\n';
+		}
+	}
+	list->words = malloc(lines * sizeof(*list->words));
+	list->lengths = malloc(lines * sizeof(*list->lengths));
+	list->frequencies = malloc(lines * sizeof(*list->frequencies));
+	if (!list->words || !list->lengths || !list->frequencies) {
+		word_list_free(list);
+		return SUGGEST_ERR_NOMEM;
+	}
+
+	for (size_t i = 0; padded && i < lines; i++) {
+		const char *segment = list->text + 1 + i * segment_size;
+		size_t length = strnlen(segment, segment_size);
+		if (length) {
+			list->words[list->count] = segment;
+			list->lengths[list->count] = (uint8_t)length;
+			list->frequencies[list->count] = 0;
+			list->count++;
+		}
+	}
+
+	size_t start = padded ? size : 0;
+	while (start < size) {
+		const char *line = list->text + start;
+		const char *end = memchr(line, '\n', size - start);
+		size_t length = end ? (size_t)(end - line) : size - start;
+		start += length + 1;
+
+		uint64_t frequency;
+		length = word_list_line(line, length, &frequency);
+		if (!length) {
+			continue;
+		}
+		if (length > UINT8_MAX) {
+			word_list_free(list);
+			return SUGGEST_ERR_FORMAT;
+		}
+		list->words[list->count] = line;
+		list->lengths[list->count] = (uint8_t)length;
+		list->frequencies[list->count] = frequency;
+		list->count++;
+	}
+
+	return SUGGEST_OK;
+}
+
+// Fixed size segments written by dict-build -f padded: the segment size, then
+// every word zero padded to it. Text has no zero bytes, so the padding at the
+// end of every segment tells the formats apart.
+static int word_list_padded (const char *text, size_t size)
+{
+	size_t segment_size = size ? (uint8_t)text[0] : 0;
+	if (segment_size < 2 || (size - 1) % segment_size) {
+		return 0;
+	}
+	for (size_t i = segment_size; i < size; i += segment_size) {
+		if (text[i]) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+size_t word_list_line (const char *line, size_t length, uint64_t *frequency)
+{
+	while (length && (line[length - 1] == '\r' || line[length - 1] == '\n')) {
+		length--;
+	}
+
+	*frequency = 0;
+	const char *tab = memchr(line, '\t', length);
+	if (tab) {
+		for (const char *digit = tab + 1; digit < line + length && *digit >= '0' && *digit <= '9'; digit++) {
+			*frequency = *frequency * 10 + (*digit - '0');
+		}
+		length = tab - line;
+	}
+
+	return length;
+}
+
+void word_list_free (struct WordList *list)
+{
+	free(list->text);
+	free(list->words);
+	free(list->lengths);
+	free(list->frequencies);
+	memset(list, 0, sizeof(*list));
+}
+
+// Image
+
+struct SortedWord {
+	const char *word;
+	uint8_t length;
+	uint64_t frequency;
+	uint64_t offset; // list index while placing, then offset from data
+	uint64_t mask;
+};
+
+// Placement order: by length, more frequent first, then as listed
+static int placed_word_compare (const void *a, const void *b)
+{
+	const struct SortedWord *left = a, *right = b;
+	if (left->length != right->length) {
+		return (int)left->length - (int)right->length;
+	}
+	if (left->frequency != right->frequency) {
+		return left->frequency > right->frequency ? -1 : 1;
+	}
+	return left->offset < right->offset ? -1 : left->offset > right->offset;
+}
+
+// Order within a partition: words with the same characters next to each
+// other, so that the block summaries stay tight
+static int clustered_word_compare (const void *a, const void *b)
+{
+	const struct SortedWord *left = a, *right = b;
+	if (left->mask != right->mask) {
+		return left->mask < right->mask ? -1 : 1;
+	}
+	return left->offset < right->offset ? -1 : left->offset > right->offset;
+}
+
+static int sorted_word_compare (const void *a, const void *b)
+{
+	const struct SortedWord *left = a, *right = b;
+	int r = memcmp(left->word, right->word, left->length < right->length ? left->length : right->length);
+	return r ? r : (int)left->length - (int)right->length;
+}
+
+static size_t image_align (size_t size)
+{
+	return (size + IMAGE_ALIGN - 1) / IMAGE_ALIGN * IMAGE_ALIGN;
+}
+
+// Exact match index over the distinct words, left out if no hash is found
+static int image_build_hash (struct Image *image, const struct SortedWord *sorted, size_t count, size_t hash_offset)
+{
+	const char **keys = malloc(count * sizeof(*keys));
+	uint8_t *lengths = malloc(count * sizeof(*lengths));
+	uint64_t *values = malloc(count * sizeof(*values));
+	if (!keys || !lengths || !values) {
+		free(keys);
+		free(lengths);
+		free(values);
+		return SUGGEST_ERR_NOMEM;
+	}
+
+	size_t distinct = 0;
+	for (size_t i = 0; i < count; i++) {
+		if (i && !sorted_word_compare(&sorted[i - 1], &sorted[i])) {
+			continue;
+		}
+		keys[distinct] = sorted[i].word;
+		lengths[distinct] = sorted[i].length;
+		values[distinct] = sorted[i].offset;
+		distinct++;
+	}
+
+	int r = mph_build((char *)image->base + hash_offset, distinct, keys, lengths, values);
+	if (r == SUGGEST_OK) {
+		struct ImageHeader *header = image->base;
+		header->sections[IMAGE_SECTION_HASH].offset = hash_offset;
+		header->sections[IMAGE_SECTION_HASH].size = mph_size(distinct);
+	}
+	free(keys);
+	free(lengths);
+	free(values);
+	return r == SUGGEST_ERR_NOMEM ? r : SUGGEST_OK;
+}
+
+// Remapping
+
+#define IMAGE_REMAP_SLOTS 512 // more than twice ALPHABET_MAX_SYMBOLS
+
+struct RemapSlot {
+	uint32_t c;
+	uint8_t used;
+	uint8_t code;
+	uint64_t count;
+};
+
+static int remap_slot_compare (const void *a, const void *b)
+{
+	const struct RemapSlot *left = a, *right = b;
+	if (left->used != right->used) {
+		return (int)right->used - (int)left->used;
+	}
+	if (left->count != right->count) {
+		return left->count > right->count ? -1 : 1;
+	}
+	return left->c < right->c ? -1 : left->c > right->c;
+}
+
+static struct RemapSlot *remap_slot (struct RemapSlot *slots, uint32_t c)
+{
+	size_t i = (c * 2654435761u) % IMAGE_REMAP_SLOTS;
+	while (slots[i].used && slots[i].c != c) {
+		i = (i + 1) % IMAGE_REMAP_SLOTS;
+	}
+	return &slots[i];
+}
+
+struct RemapWord {
+	const char *word;
+	uint8_t length;
+	size_t index;
+};
+
+static int remap_word_compare (const void *a, const void *b)
+{
+	const struct RemapWord *left = a, *right = b;
+	if (left->length != right->length) {
+		return (int)left->length - (int)right->length;
+	}
+	int c = memcmp(left->word, right->word, left->length);
+	if (c) {
+		return c;
+	}
+	return left->index < right->index ? -1 : left->index > right->index;
+}
+
+// Case folding makes some words equal ("Word" and "word"): the first one is
+// kept, with the highest frequency of them
+static int image_remap_unique (struct WordList *coded)
+{
+	struct RemapWord *words = malloc((coded->count ? coded->count : 1) * sizeof(*words));
+	uint8_t *dropped = calloc(coded->count ? coded->count : 1, sizeof(*dropped));
+	if (!words || !dropped) {
+		free(words);
+		free(dropped);
+		return SUGGEST_ERR_NOMEM;
+	}
+	for (size_t i = 0; i < coded->count; i++) {
+		words[i].word = coded->words[i];
+		words[i].length = coded->lengths[i];
+		words[i].index = i;
+	}
+	qsort(words, coded->count, sizeof(*words), remap_word_compare);
+	for (size_t i = 1, first = 0; i < coded->count; i++) {
+		if (words[i].length != words[first].length || memcmp(words[i].word, words[first].word, words[i].length)) {
+			first = i;
+			continue;
+		}
+		dropped[words[i].index] = 1;
+		if (coded->frequencies[words[i].index] > coded->frequencies[words[first].index]) {
+			coded->frequencies[words[first].index] = coded->frequencies[words[i].index];
+		}
+	}
+
+	size_t count = 0;
+	for (size_t i = 0; i < coded->count; i++) {
+		if (!dropped[i]) {
+			coded->words[count] = coded->words[i];
+			coded->lengths[count] = coded->lengths[i];
+			coded->frequencies[count] = coded->frequencies[i];
+			count++;
+		}
+	}
+	coded->count = count;
+	free(words);
+	free(dropped);
+	return SUGGEST_OK;
+}
+
+// Codes words by their characters, the most frequent characters first
+static int image_remap (const struct WordList *list, int encoding, struct WordList *coded,
+						struct ImageAlphabet *alphabet)
+{
+	memset(coded, 0, sizeof(*coded));
+	memset(alphabet, 0, sizeof(*alphabet));
+	alphabet->encoding = encoding;
+
+	struct RemapSlot slots[IMAGE_REMAP_SLOTS] = { { 0 } };
+	uint32_t chars[UINT8_MAX];
+	size_t text_size = 0;
+	for (size_t i = 0; i < list->count; i++) {
+		size_t count = alphabet_decode(encoding, list->words[i], list->lengths[i], chars, UINT8_MAX);
+		for (size_t j = 0; j < count; j++) {
+			struct RemapSlot *slot = remap_slot(slots, chars[j]);
+			if (!slot->used && ++alphabet->symbol_count > ALPHABET_MAX_SYMBOLS) {
+				return SUGGEST_ERR_FORMAT;
+			}
+			slot->c = chars[j];
+			slot->used = 1;
+			slot->count++;
+		}
+		text_size += count;
+	}
+
+	struct RemapSlot ranked[IMAGE_REMAP_SLOTS];
+	memcpy(ranked, slots, sizeof(slots));
+	qsort(ranked, IMAGE_REMAP_SLOTS, sizeof(*ranked), remap_slot_compare);
+	for (uint32_t code = 1; code <= alphabet->symbol_count; code++) {
+		alphabet->symbols[code] = ranked[code - 1].c;
+		remap_slot(slots, ranked[code - 1].c)->code = code;
+	}
+
+	coded->text = malloc(text_size ? text_size : 1);
+	coded->words = malloc((list->count ? list->count : 1) * sizeof(*coded->words));
+	coded->lengths = malloc((list->count ? list->count : 1) * sizeof(*coded->lengths));
+	coded->frequencies = calloc(list->count ? list->count : 1, sizeof(*coded->frequencies));
+	if (!coded->text || !coded->words || !coded->lengths || !coded->frequencies) {
+		word_list_free(coded);
+		return SUGGEST_ERR_NOMEM;
+	}
+	char *text = coded->text;
+	for (size_t i = 0; i < list->count; i++) {
+		size_t count = alphabet_decode(encoding, list->words[i], list->lengths[i], chars, UINT8_MAX);
+		char spelling[4 * UINT8_MAX];
+		if (alphabet_encode(encoding, chars, count, spelling) > UINT8_MAX) {
+			word_list_free(coded);
+			return SUGGEST_ERR_FORMAT;
+		}
+		coded->words[i] = text;
+		coded->lengths[i] = count;
+		coded->frequencies[i] = list->frequencies ? list->frequencies[i] : 0;
+		for (size_t j = 0; j < count; j++) {
+			*text++ = remap_slot(slots, chars[j])->code;
+		}
+	}
+	coded->count = list->count;
+
+	int r = image_remap_unique(coded);
+	if (r != SUGGEST_OK) {
+		word_list_free(coded);
+	}
+	return r;
+}
+
+static int image_build_words (const struct WordList *list, uint32_t partition_words,
+							  const struct ImageAlphabet *alphabet, int coding, struct Image *image);
+
+int image_build (const struct WordList *list, uint32_t partition_words, int encoding, int coding,
+				 struct Image *image)
+{
+	memset(image, 0, sizeof(*image));
+	if (!partition_words || encoding < ALPHABET_BYTES || encoding > ALPHABET_UTF8
+		|| (coding != IMAGE_CODING_PLAIN && coding != IMAGE_CODING_FRONT)
+		|| (coding == IMAGE_CODING_FRONT && encoding != ALPHABET_BYTES)) {
+		return SUGGEST_ERR_ARGUMENT;
+	}
+	if (encoding == ALPHABET_BYTES) {
+		return image_build_words(list, partition_words, NULL, coding, image);
+	}
+
+	struct WordList coded;
+	struct ImageAlphabet alphabet;
+	int r = image_remap(list, encoding, &coded, &alphabet);
+	if (r == SUGGEST_OK) {
+		r = image_build_words(&coded, partition_words, &alphabet, IMAGE_CODING_PLAIN, image);
+		word_list_free(&coded);
+	}
+	return r;
+}
+
+// Leading bytes two words of one length have in common
+static size_t image_shared_prefix (const char *left, const char *right, size_t length)
+{
+	size_t shared = 0;
+	while (shared < length && left[shared] == right[shared]) {
+		shared++;
+	}
+	return shared;
+}
+
+// Bytes of the front-coded words of a partition
+static size_t image_front_coded_size (const struct SortedWord *sorted, size_t count)
+{
+	size_t size = 0;
+	for (size_t i = 0; i < count; i++) {
+		size_t shared = i % IMAGE_BLOCK_WORDS
+			? image_shared_prefix(sorted[i - 1].word, sorted[i].word, sorted[i].length) : 0;
+		size += sizeof(uint8_t) + sorted[i].length - shared;
+	}
+	return size;
+}
+
+static int image_build_words (const struct WordList *list, uint32_t partition_words,
+							  const struct ImageAlphabet *alphabet, int coding, struct Image *image)
+{
+	int front_coded = coding == IMAGE_CODING_FRONT;
+
+	// Bytes of every code as text, for the spellings
+	uint8_t spelled[256] = { 0 };
+	for (uint32_t code = 1; alphabet && code <= alphabet->symbol_count; code++) {
+		char text[4];
+		spelled[code] = alphabet_encode(alphabet->encoding, &alphabet->symbols[code], 1, text);
+	}
+
+	struct SortedWord *sorted = malloc((list->count ? list->count : 1) * sizeof(*sorted));
+	if (!sorted) {
+		return SUGGEST_ERR_NOMEM;
+	}
+	for (size_t i = 0; i < list->count; i++) {
+		sorted[i].word = list->words[i];
+		sorted[i].length = list->lengths[i];
+		sorted[i].frequency = list->frequencies ? list->frequencies[i] : 0;
+		sorted[i].offset = i;
+		sorted[i].mask = image_word_mask(sorted[i].word, sorted[i].length);
+	}
+	qsort(sorted, list->count, sizeof(*sorted), placed_word_compare);
+
+	// A partition ends at a length change or after partition_words words,
+	// a block after IMAGE_BLOCK_WORDS words of a partition. Front-coded
+	// blocks are sorted, so that neighbours share their first bytes.
+	uint64_t partition_count = 0;
+	uint64_t block_count = 0;
+	size_t data_size = 0;
+	size_t spellings_size = 0;
+	uint8_t max_string_length = 0;
+	for (size_t i = 0, in_partition = 0, partition_start = 0; i <= list->count; i++) {
+		if (i == list->count || !in_partition || in_partition == partition_words
+			|| sorted[i].length != sorted[i - 1].length) {
+			qsort(sorted + partition_start, i - partition_start, sizeof(*sorted), clustered_word_compare);
+			for (size_t first = partition_start; front_coded && first < i; first += IMAGE_BLOCK_WORDS) {
+				size_t count = i - first < IMAGE_BLOCK_WORDS ? i - first : IMAGE_BLOCK_WORDS;
+				qsort(sorted + first, count, sizeof(*sorted), sorted_word_compare);
+			}
+			if (front_coded) {
+				data_size += image_front_coded_size(sorted + partition_start, i - partition_start);
+			}
+			if (i == list->count) {
+				break;
+			}
+			partition_start = i;
+			partition_count++;
+			data_size += front_coded ? 0 : sizeof(uint8_t); // zero length terminator
+			in_partition = 0;
+		}
+		if (!(in_partition % IMAGE_BLOCK_WORDS)) {
+			block_count++;
+		}
+		in_partition++;
+		data_size += front_coded ? 0 : sizeof(uint8_t) + sorted[i].length;
+		if (alphabet) {
+			spellings_size += sizeof(uint64_t) + sizeof(uint8_t);
+			for (size_t j = 0; j < sorted[i].length; j++) {
+				spellings_size += spelled[(unsigned char)sorted[i].word[j]];
+			}
+		}
+		if (max_string_length < sorted[i].length) {
+			max_string_length = sorted[i].length;
+		}
+	}
+
+	size_t data_offset = image_align(sizeof(struct ImageHeader));
+	size_t partitions_offset = image_align(data_offset + data_size);
+	size_t partitions_size = partition_count * sizeof(struct ImagePartition);
+	size_t sorted_offset = image_align(partitions_offset + partitions_size);
+	size_t sorted_size = front_coded ? 0 : list->count * sizeof(uint64_t);
+	size_t lengths_offset = image_align(sorted_offset + sorted_size);
+	size_t lengths_size = front_coded ? 0 : list->count * sizeof(uint8_t);
+	size_t offsets_offset = image_align(lengths_offset + lengths_size);
+	size_t offsets_size = front_coded ? 0 : list->count * sizeof(uint64_t);
+	size_t masks_offset = image_align(offsets_offset + offsets_size);
+	size_t masks_size = front_coded ? 0 : list->count * sizeof(uint64_t);
+	size_t blocks_offset = image_align(masks_offset + masks_size);
+	size_t blocks_size = block_count * sizeof(struct ImageBlock);
+	size_t alphabet_offset = image_align(blocks_offset + blocks_size);
+	size_t alphabet_size = alphabet ? sizeof(*alphabet) : 0;
+	size_t spellings_offset = image_align(alphabet_offset + alphabet_size);
+	size_t hash_offset = image_align(spellings_offset + spellings_size);
+	size_t hash_size = front_coded ? 0 : mph_size(list->count); // duplicate words are hashed once, so it may end up smaller
+	image->size = hash_offset + hash_size;
+	image->base = calloc(image->size, 1);
+	if (!image->base) {
+		free(sorted);
+		return SUGGEST_ERR_NOMEM;
+	}
+
+	struct ImageHeader *header = image->base;
+	memcpy(header->magic, IMAGE_MAGIC, sizeof(header->magic));
+	header->version = IMAGE_VERSION;
+	header->max_string_length = max_string_length;
+	header->coding = coding;
+	header->word_count = list->count;
+	header->partition_count = partition_count;
+	header->data_offset = data_offset;
+	header->data_size = data_size;
+	header->image_size = image->size;
+	header->sections[IMAGE_SECTION_PARTITIONS].offset = partitions_offset;
+	header->sections[IMAGE_SECTION_PARTITIONS].size = partitions_size;
+	header->sections[IMAGE_SECTION_SORTED].offset = sorted_offset;
+	header->sections[IMAGE_SECTION_SORTED].size = sorted_size;
+	header->sections[IMAGE_SECTION_LENGTHS].offset = lengths_offset;
+	header->sections[IMAGE_SECTION_LENGTHS].size = lengths_size;
+	header->sections[IMAGE_SECTION_OFFSETS].offset = offsets_offset;
+	header->sections[IMAGE_SECTION_OFFSETS].size = offsets_size;
+	header->sections[IMAGE_SECTION_MASKS].offset = masks_offset;
+	header->sections[IMAGE_SECTION_MASKS].size = masks_size;
+	header->sections[IMAGE_SECTION_BLOCKS].offset = blocks_offset;
+	header->sections[IMAGE_SECTION_BLOCKS].size = blocks_size;
+	header->sections[IMAGE_SECTION_ALPHABET].offset = alphabet_offset;
+	header->sections[IMAGE_SECTION_ALPHABET].size = alphabet_size;
+	header->sections[IMAGE_SECTION_SPELLINGS].offset = spellings_offset;
+	header->sections[IMAGE_SECTION_SPELLINGS].size = spellings_size;
+	if (alphabet) {
+		memcpy((char *)image->base + alphabet_offset, alphabet, sizeof(*alphabet));
+	}
+	image->header = header;
+	image->data = (char *)image->base + data_offset;
+
+	struct ImagePartition *partitions = (struct ImagePartition *)((char *)image->base + partitions_offset);
+	image->partitions = partitions;
+	uint8_t *lengths = (uint8_t *)image->base + lengths_offset;
+	uint64_t *offsets = (uint64_t *)((char *)image->base + offsets_offset);
+	uint64_t *masks = (uint64_t *)((char *)image->base + masks_offset);
+	struct ImageBlock *blocks = (struct ImageBlock *)((char *)image->base + blocks_offset);
+	struct ImageBlock *block = NULL;
+	uint64_t *spelling_offsets = (uint64_t *)((char *)image->base + spellings_offset);
+	char *spelling = (char *)(spelling_offsets + list->count);
+	char *offset = (char *)image->data;
+	struct ImagePartition *partition = NULL;
+	for (size_t i = 0; i < list->count; i++) {
+		if (!partition || partition->word_count == partition_words || sorted[i].length != partition->length) {
+			if (partition) {
+				offset += front_coded ? 0 : 1; // zero length terminator
+				partition->size = offset - image->data - partition->offset;
+			}
+			partition = partition ? partition + 1 : partitions;
+			partition->offset = offset - image->data;
+			partition->length = sorted[i].length;
+			partition->tier = partition > partitions && partition[-1].length == partition->length
+				? partition[-1].tier + 1 : 0;
+		}
+		int restart = !(partition->word_count % IMAGE_BLOCK_WORDS);
+		if (restart) {
+			block = block ? block + 1 : blocks;
+			block->offset = offset - image->data;
+			block->all = ~(uint64_t)0;
+			block->min_length = block->max_length = sorted[i].length;
+		}
+		partition->word_count++;
+
+		if (front_coded) {
+			size_t shared = restart ? 0 : image_shared_prefix(sorted[i - 1].word, sorted[i].word, sorted[i].length);
+			*offset = shared;
+			memcpy(offset + 1, sorted[i].word + shared, sorted[i].length - shared);
+			offset += 1 + sorted[i].length - shared;
+		} else {
+			*offset = sorted[i].length;
+			memcpy(offset + 1, sorted[i].word, sorted[i].length);
+			sorted[i].offset = offset - image->data;
+			lengths[i] = sorted[i].length;
+			offsets[i] = sorted[i].offset;
+			masks[i] = sorted[i].mask;
+			offset += 1 + sorted[i].length;
+		}
+		block->any |= sorted[i].mask;
+		block->all &= sorted[i].mask;
+		block->min_length = sorted[i].length < block->min_length ? sorted[i].length : block->min_length;
+		block->max_length = sorted[i].length > block->max_length ? sorted[i].length : block->max_length;
+		block->word_count++;
+
+		if (alphabet) {
+			uint32_t chars[UINT8_MAX];
+			for (size_t j = 0; j < sorted[i].length; j++) {
+				chars[j] = alphabet->symbols[(unsigned char)sorted[i].word[j]];
+			}
+			spelling_offsets[i] = spelling - (char *)spelling_offsets;
+			*spelling = alphabet_encode(alphabet->encoding, chars, sorted[i].length, spelling + 1);
+			spelling += 1 + (uint8_t)*spelling;
+		}
+	}
+	if (partition) {
+		offset += front_coded ? 0 : 1;
+		partition->size = offset - image->data - partition->offset;
+	}
+
+	// Front-coded images have no index into the words
+	if (!front_coded) {
+		qsort(sorted, list->count, sizeof(*sorted), sorted_word_compare);
+		uint64_t *sorted_offsets = (uint64_t *)((char *)image->base + sorted_offset);
+		for (size_t i = 0; i < list->count; i++) {
+			sorted_offsets[i] = sorted[i].offset;
+		}
+	}
+
+	int r = hash_size ? image_build_hash(image, sorted, list->count, hash_offset) : SUGGEST_OK;
+	free(sorted);
+	if (r != SUGGEST_OK) {
+		image_free(image);
+	}
+	return r;
+}
+
+static int image_map_fd (int fd, struct Image *image);
+static int image_validate (const struct Image *image);
+static int image_validate_partition (const struct Image *image, const struct ImagePartition *partition,
+									 uint64_t first_word, uint64_t first_block);
+
+int image_load (const char *filename, struct Image *image)
+{
+	memset(image, 0, sizeof(*image));
+
+	int fd = open(filename, O_RDONLY);
+	if (fd == -1) {
+		return SUGGEST_ERR_IO;
+	}
+	int r = image_load_fd(fd, image);
+	close(fd);
+	return r;
+}
+
+int image_load_fd (int fd, struct Image *image)
+{
+	int r = image_map_fd(fd, image);
+	if (r == SUGGEST_OK && (r = image_validate(image)) != SUGGEST_OK) {
+		image_free(image);
+	}
+	return r;
+}
+
+// Maps the image once the header and the section bounds check out, which
+// costs the same whatever the image size
+static int image_map_fd (int fd, struct Image *image)
+{
+	memset(image, 0, sizeof(*image));
+
+	struct ImageHeader header;
+	ssize_t read_bytes = pread(fd, &header, sizeof(header), 0);
+	if (read_bytes == -1) {
+		return SUGGEST_ERR_IO;
+	}
+	if (read_bytes < (ssize_t)sizeof(header.magic) || memcmp(header.magic, IMAGE_MAGIC, sizeof(header.magic))) {
+		return IMAGE_NOT_IMAGE;
+	}
+
+	struct stat sb;
+	if (fstat(fd, &sb) == -1) {
+		return SUGGEST_ERR_IO;
+	}
+	int valid = read_bytes == sizeof(header) && header.version == IMAGE_VERSION
+		&& header.image_size == (uint64_t)sb.st_size && header.data_offset >= sizeof(header)
+		&& header.data_offset + header.data_size <= header.image_size
+		&& header.sections[IMAGE_SECTION_PARTITIONS].size == header.partition_count * sizeof(struct ImagePartition)
+		&& (!header.sections[IMAGE_SECTION_LENGTHS].size
+			|| (header.sections[IMAGE_SECTION_LENGTHS].size == header.word_count * sizeof(uint8_t)
+				&& header.sections[IMAGE_SECTION_OFFSETS].size == header.word_count * sizeof(uint64_t)
+				&& header.sections[IMAGE_SECTION_MASKS].size == header.word_count * sizeof(uint64_t)))
+		&& (!header.sections[IMAGE_SECTION_HASH].size
+			|| header.sections[IMAGE_SECTION_HASH].size >= sizeof(struct MphHeader))
+		&& (header.coding == IMAGE_CODING_PLAIN
+			|| (header.coding == IMAGE_CODING_FRONT && (header.sections[IMAGE_SECTION_BLOCKS].size || !header.word_count)
+				&& !header.sections[IMAGE_SECTION_SORTED].size && !header.sections[IMAGE_SECTION_LENGTHS].size
+				&& !header.sections[IMAGE_SECTION_HASH].size && !header.sections[IMAGE_SECTION_ALPHABET].size));
+	for (int i = 0; i < IMAGE_SECTION_MAX && valid; i++) {
+		valid = !header.sections[i].size || (!(header.sections[i].offset % sizeof(uint64_t))
+			&& header.sections[i].offset + header.sections[i].size <= header.image_size);
+	}
+	if (!valid) {
+		return SUGGEST_ERR_FORMAT;
+	}
+
+	image->size = sb.st_size;
+	image->base = mmap(NULL, image->size, PROT_READ, MAP_SHARED, fd, 0);
+	if (image->base == MAP_FAILED) {
+		image->base = NULL;
+		return SUGGEST_ERR_IO;
+	}
+	image->mapped = 1;
+	image->header = image->base;
+	image->data = (const char *)image->base + header.data_offset;
+	image->partitions = (const struct ImagePartition *)((const char *)image->base
+		+ header.sections[IMAGE_SECTION_PARTITIONS].offset);
+
+	return SUGGEST_OK;
+}
+
+// Every offset, length and count of an image file that a reader follows, at a
+// cost linear in the number of words; the character masks of the words and
+// blocks only steer the scans and are taken as they are
+static int image_validate (const struct Image *image)
+{
+	const struct ImageHeader header = *image->header;
+	uint64_t word_count = 0;
+	uint64_t block_count = 0;
+	for (uint64_t i = 0; i < header.partition_count; i++) {
+		const struct ImagePartition *partition = &image->partitions[i];
+		if (!partition->size || partition->offset > header.data_size
+			|| partition->size > header.data_size - partition->offset
+			|| image_validate_partition(image, partition, word_count, block_count) != SUGGEST_OK) {
+			return SUGGEST_ERR_FORMAT;
+		}
+		word_count += partition->word_count;
+		block_count += (partition->word_count + IMAGE_BLOCK_WORDS - 1) / IMAGE_BLOCK_WORDS;
+	}
+	if (word_count != header.word_count) {
+		return SUGGEST_ERR_FORMAT;
+	}
+
+	// Completion reads every word of the sorted index through its offset
+	uint64_t sorted_size;
+	const uint64_t *sorted = image_section(image, IMAGE_SECTION_SORTED, &sorted_size);
+	for (uint64_t i = 0; sorted && i < sorted_size / sizeof(uint64_t); i++) {
+		if (sorted[i] >= header.data_size || header.data_size - sorted[i] <= (uint8_t)image->data[sorted[i]]) {
+			return SUGGEST_ERR_FORMAT;
+		}
+	}
+
+	// Every block was checked along the walk of its partition
+	uint64_t blocks_size;
+	const struct ImageBlock *blocks = image_section(image, IMAGE_SECTION_BLOCKS, &blocks_size);
+	int valid = !blocks || blocks_size == block_count * sizeof(struct ImageBlock);
+	if (!valid) {
+		return SUGGEST_ERR_FORMAT;
+	}
+
+	uint64_t alphabet_size, spellings_size;
+	const struct ImageAlphabet *alphabet = image_section(image, IMAGE_SECTION_ALPHABET, &alphabet_size);
+	const uint64_t *spellings = image_section(image, IMAGE_SECTION_SPELLINGS, &spellings_size);
+	valid = !alphabet == !spellings && (!alphabet || (alphabet_size == sizeof(*alphabet)
+		&& alphabet->encoding > ALPHABET_BYTES && alphabet->encoding <= ALPHABET_UTF8
+		&& alphabet->symbol_count <= ALPHABET_MAX_SYMBOLS && header.sections[IMAGE_SECTION_LENGTHS].size
+		&& spellings_size / sizeof(uint64_t) >= header.word_count));
+	for (uint64_t i = 0; spellings && valid && i < header.word_count; i++) {
+		valid = spellings[i] >= header.word_count * sizeof(uint64_t) && spellings[i] < spellings_size
+			&& spellings[i] + 1 + (uint8_t)((const char *)spellings)[spellings[i]] <= spellings_size;
+	}
+	if (!valid) {
+		return SUGGEST_ERR_FORMAT;
+	}
+
+	uint64_t hash_size;
+	const struct MphHeader *hash = image_section(image, IMAGE_SECTION_HASH, &hash_size);
+	if (hash && (!hash->slot_count || hash->slot_count > header.word_count
+				 || hash->bucket_count != (hash->slot_count + MPH_BUCKET_KEYS - 1) / MPH_BUCKET_KEYS
+				 || hash_size != mph_size(hash->slot_count))) {
+		return SUGGEST_ERR_FORMAT;
+	}
+
+	return SUGGEST_OK;
+}
+
+// The words of a partition, walked as a scan walks them: word_count words of
+// the partition length, each ending within the partition. Plain words are
+// length-prefixed, and the last one is followed by the terminator; front-coded
+// ones share at most the whole length with the previous word of their block,
+// nothing for the first one. The columns and the blocks, when there are any,
+// have to describe the same words from first_word and first_block on.
+static int image_validate_partition (const struct Image *image, const struct ImagePartition *partition,
+									 uint64_t first_word, uint64_t first_block)
+{
+	int plain = image->header->coding == IMAGE_CODING_PLAIN;
+	uint64_t size, blocks_size;
+	const uint8_t *lengths = image_section(image, IMAGE_SECTION_LENGTHS, &size);
+	const uint64_t *offsets = image_section(image, IMAGE_SECTION_OFFSETS, &size);
+	const struct ImageBlock *blocks = image_section(image, IMAGE_SECTION_BLOCKS, &blocks_size);
+	const char *words = image->data + partition->offset;
+	size = partition->size - (plain ? sizeof(uint8_t) : 0);
+	if ((plain && words[size]) || (lengths && first_word + partition->word_count > image->header->word_count)
+		|| (blocks && first_block + (partition->word_count + IMAGE_BLOCK_WORDS - 1) / IMAGE_BLOCK_WORDS
+			> blocks_size / sizeof(*blocks))) {
+		return SUGGEST_ERR_FORMAT;
+	}
+	uint64_t offset = 0;
+	for (uint32_t i = 0; i < partition->word_count; i++) {
+		uint8_t shared = plain ? 0 : (uint8_t)words[offset];
+		if (!partition->length || size - offset < sizeof(uint8_t) + partition->length - shared
+			|| (plain ? (uint8_t)words[offset] != partition->length
+				: shared > (i % IMAGE_BLOCK_WORDS ? partition->length : 0))) {
+			return SUGGEST_ERR_FORMAT;
+		}
+		// A block is read from its first word on, for its word count, and
+		// front-coded words are decoded with the length of their block
+		if (blocks && !(i % IMAGE_BLOCK_WORDS)) {
+			const struct ImageBlock *block = &blocks[first_block + i / IMAGE_BLOCK_WORDS];
+			uint32_t left = partition->word_count - i;
+			if (block->offset != partition->offset + offset
+				|| block->word_count != (left < IMAGE_BLOCK_WORDS ? left : IMAGE_BLOCK_WORDS)
+				|| block->min_length != partition->length || block->max_length != partition->length) {
+				return SUGGEST_ERR_FORMAT;
+			}
+		}
+		if (lengths && (lengths[first_word + i] != partition->length
+						|| offsets[first_word + i] != partition->offset + offset)) {
+			return SUGGEST_ERR_FORMAT;
+		}
+		offset += sizeof(uint8_t) + partition->length - shared;
+	}
+	return offset == size ? SUGGEST_OK : SUGGEST_ERR_FORMAT;
+}
+
+const char *image_find (const struct Image *image, const char *word, size_t length)
+{
+	uint64_t size;
+	const void *hash = image_section(image, IMAGE_SECTION_HASH, &size);
+	if (!hash) {
+		return NULL;
+	}
+	uint64_t offset = mph_value(hash, word, length);
+	const char *found = image->data + offset;
+	if (offset + 1 + length > image->header->data_size || (uint8_t)*found != length
+		|| memcmp(found + 1, word, length)) {
+		return NULL;
+	}
+	return found + 1;
+}
+
+void image_find_batch (const struct Image *image, size_t count, const char *const *words, const size_t *lengths,
+					   const char **found)
+{
+	uint64_t size;
+	const void *hash = image_section(image, IMAGE_SECTION_HASH, &size);
+	uint64_t offsets[MPH_BATCH];
+	for (size_t first = 0; first < count; first += MPH_BATCH) {
+		size_t batch = count - first < MPH_BATCH ? count - first : MPH_BATCH;
+		if (!hash) {
+			memset(found + first, 0, batch * sizeof(*found));
+			continue;
+		}
+		mph_value_batch(hash, batch, words + first, lengths + first, offsets);
+		for (size_t i = 0; i < batch; i++) {
+			if (offsets[i] < image->header->data_size) {
+				__builtin_prefetch(image->data + offsets[i]);
+			}
+		}
+		for (size_t i = 0; i < batch; i++) {
+			const char *word = image->data + offsets[i];
+			size_t length = lengths[first + i];
+			found[first + i] = offsets[i] + 1 + length <= image->header->data_size && (uint8_t)*word == length
+				&& !memcmp(word + 1, words[first + i], length) ? word + 1 : NULL;
+		}
+	}
+}
+
+// Shared images
+
+#define IMAGE_ATTACH_RETRY 2 // internal image_attach() result: the object was replaced, open it again
+#define IMAGE_ATTACH_ATTEMPTS 4
+
+static int image_attach_fd (int fd, const struct ImageSource *source, struct Image *image);
+static int image_share (int fd, const char *filename, const struct ImageSource *source, uint32_t partition_words);
+static int image_named (int fd, const char *name);
+
+int image_attach (const char *name, const char *filename, uint32_t partition_words, int encoding,
+				  struct Image *image)
+{
+	memset(image, 0, sizeof(*image));
+
+	struct stat sb;
+	if (stat(filename, &sb) == -1) {
+		return SUGGEST_ERR_IO;
+	}
+	struct ImageSource source = { sb.st_dev, sb.st_ino, sb.st_size, sb.st_mtim.tv_sec, sb.st_mtim.tv_nsec, encoding };
+
+	for (int attempt = 0; attempt < IMAGE_ATTACH_ATTEMPTS; attempt++) {
+		int fd = shm_open(name, O_RDWR | O_CREAT, 0644);
+		if (fd == -1) {
+			return SUGGEST_ERR_IO;
+		}
+
+		// A shared lock waits for a build in progress
+		int r = flock(fd, LOCK_SH) == -1 ? SUGGEST_ERR_IO : image_attach_fd(fd, &source, image);
+		if (r == IMAGE_NOT_IMAGE) {
+			// Empty, stale or left unfinished: whoever gets the exclusive lock
+			// first builds it, the others find it built when they get the lock
+			r = flock(fd, LOCK_EX) == -1 ? SUGGEST_ERR_IO : image_attach_fd(fd, &source, image);
+		}
+		if (r == IMAGE_NOT_IMAGE) {
+			struct stat object;
+			if (!image_named(fd, name)) {
+				r = IMAGE_ATTACH_RETRY;
+			} else if (fstat(fd, &object) == -1) {
+				r = SUGGEST_ERR_IO;
+			} else if (object.st_size) {
+				// Processes still using the old image keep their mapping
+				shm_unlink(name);
+				r = IMAGE_ATTACH_RETRY;
+			} else if ((r = image_share(fd, filename, &source, partition_words)) == SUGGEST_OK) {
+				r = image_attach_fd(fd, &source, image);
+			}
+		}
+		close(fd);
+
+		if (r != IMAGE_ATTACH_RETRY) {
+			return r == IMAGE_NOT_IMAGE ? SUGGEST_ERR_FORMAT : r;
+		}
+	}
+
+	return SUGGEST_ERR_IO;
+}
+
+// Maps the object if it holds a complete image of the source as it is now.
+// Its contents are only written by image_share(), from the word list, under
+// the exclusive lock and before the magic, so attaching checks the header
+// and the sections alone, not every word.
+static int image_attach_fd (int fd, const struct ImageSource *source, struct Image *image)
+{
+	int r = image_map_fd(fd, image);
+	if (r == SUGGEST_ERR_FORMAT) {
+		return IMAGE_NOT_IMAGE;
+	}
+	if (r != SUGGEST_OK) {
+		return r;
+	}
+
+	uint64_t size;
+	const struct ImageSource *built_from = image_section(image, IMAGE_SECTION_SOURCE, &size);
+	if (size != sizeof(*source) || memcmp(built_from, source, sizeof(*source))) {
+		image_free(image);
+		return IMAGE_NOT_IMAGE;
+	}
+	return SUGGEST_OK;
+}
+
+// Builds the word list into the empty object, the magic written last so that
+// an interrupted build is never attached
+static int image_share (int fd, const char *filename, const struct ImageSource *source, uint32_t partition_words)
+{
+	FILE *file = fopen(filename, "r");
+	if (!file) {
+		return SUGGEST_ERR_IO;
+	}
+	struct WordList list;
+	int r = word_list_read(file, &list);
+	fclose(file);
+	if (r != SUGGEST_OK) {
+		return r;
+	}
+	struct Image built;
+	r = image_build(&list, partition_words, source->encoding, IMAGE_CODING_PLAIN, &built);
+	word_list_free(&list);
+	if (r != SUGGEST_OK) {
+		return r;
+	}
+
+	size_t source_offset = image_align(built.size);
+	size_t size = source_offset + sizeof(*source);
+	char *base = MAP_FAILED;
+	if (ftruncate(fd, size) == -1
+		|| (base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+		image_free(&built);
+		return SUGGEST_ERR_IO;
+	}
+
+	struct ImageHeader *header = (struct ImageHeader *)base;
+	memcpy(base + sizeof(header->magic), (const char *)built.base + sizeof(header->magic),
+		   built.size - sizeof(header->magic));
+	header->image_size = size;
+	header->sections[IMAGE_SECTION_SOURCE].offset = source_offset;
+	header->sections[IMAGE_SECTION_SOURCE].size = sizeof(*source);
+	memcpy(base + source_offset, source, sizeof(*source));
+	memcpy(header->magic, IMAGE_MAGIC, sizeof(header->magic));
+
+	munmap(base, size);
+	image_free(&built);
+	return SUGGEST_OK;
+}
+
+// Whether the name still refers to the object open on fd
+static int image_named (int fd, const char *name)
+{
+	int named = shm_open(name, O_RDONLY, 0);
+	if (named == -1) {
+		return 0;
+	}
+	struct stat left, right;
+	int same = fstat(fd, &left) != -1 && fstat(named, &right) != -1
+		&& left.st_dev == right.st_dev && left.st_ino == right.st_ino;
+	close(named);
+	return same;
+}
+
+int image_write (const struct Image *image, FILE *stream)
+{
+	if (fwrite(image->base, 1, image->size, stream) != image->size || fflush(stream)) {
+		return SUGGEST_ERR_IO;
+	}
+	return SUGGEST_OK;
+}
+
+void image_free (struct Image *image)
+{
+	if (image->mapped) {
+		munmap(image->base, image->size);
+	} else {
+		free(image->base);
+	}
+	memset(image, 0, sizeof(*image));
+}
@@ -0,0 +1,248 @@
+/** 
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2013, Valera Leontyev.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *  - this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *  - this list of conditions and the following disclaimer in the documentation
+ *  - and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of the Valera Leontyev nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef IMAGE_H_INCLUDED
+#define IMAGE_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "alphabet.h"
+
+/* Dictionary image: the in-memory dictionary layout of libsuggest, written
+ * out by dict-build so that it can be mapped instead of parsed.
+ *
+ * header | padding up to data_offset | partitions | sections
+ *
+ * Words are ordered by length, and by descending frequency within a length,
+ * then cut into partitions of at most partition_words words of one length;
+ * within a partition, words with the same characters are kept together.
+ * A partition holds length-prefixed words (one length byte, then the word
+ * bytes) ended by a zero length; the partition table section describes where
+ * each partition is and what it holds. Other sections are optional indexes
+ * over the partitions, found through the section table in the header; a zero
+ * size means the section is absent. The length, offset and mask sections are
+ * a columnar view of the words: a scan can filter on the dense columns and
+ * only touch the bytes of the words that pass.
+ * Each partition is also cut into blocks of IMAGE_BLOCK_WORDS words, with
+ * words of similar character sets next to each other, and the block section
+ * summarizes every block so that a scan can skip it as a whole.
+ * With an alphabet (see alphabet.h) the words are stored as symbol codes, and
+ * the spelling section keeps them as (case folded) text for the results.
+ * A word list read from text is turned into exactly the same bytes in memory.
+ *
+ * Front-coded images (IMAGE_CODING_FRONT) keep only the partitions and the
+ * block section. Words are sorted within a block, and every word is one byte
+ * counting the leading bytes it shares with the previous word of its block
+ * (0 for the first one, where decoding restarts), then the rest of its bytes;
+ * the length is that of the partition, and there is no terminator.
+ */
+
+#define IMAGE_MAGIC "SGIMAGE1"
+#define IMAGE_VERSION 4
+#define IMAGE_ALIGN 64
+#define IMAGE_PARTITION_WORDS 4096
+#define IMAGE_BLOCK_WORDS 64
+
+// Sections
+#define IMAGE_SECTION_PARTITIONS 0 // struct ImagePartition per partition
+#define IMAGE_SECTION_SORTED 1     // uint64_t offsets of the words (from data) in byte order
+#define IMAGE_SECTION_LENGTHS 2    // uint8_t length per word, in data order
+#define IMAGE_SECTION_OFFSETS 3    // uint64_t offset per word (from data), in data order
+#define IMAGE_SECTION_MASKS 4      // uint64_t image_word_mask() per word, in data order
+#define IMAGE_SECTION_SOURCE 5     // struct ImageSource, in shared images only
+#define IMAGE_SECTION_HASH 6       // minimal perfect hash of the words (see mph.h) to their offsets (from data)
+#define IMAGE_SECTION_BLOCKS 7     // struct ImageBlock per block of IMAGE_BLOCK_WORDS words, in data order
+#define IMAGE_SECTION_ALPHABET 8   // struct ImageAlphabet, in images of remapped words only
+#define IMAGE_SECTION_SPELLINGS 9  // uint64_t offset per word (from the section), in data order, then the
+                                   // length-prefixed words as text, in images of remapped words only
+#define IMAGE_SECTION_MAX 16
+
+// Codings of the partitions
+#define IMAGE_CODING_PLAIN 0 // length-prefixed words
+#define IMAGE_CODING_FRONT 1 // front-coded words, restarting at every block
+
+// image_load() result for a file that is not an image (e.g. a word list)
+#define IMAGE_NOT_IMAGE 1
+
+struct ImageSection {
+	uint64_t offset; // from the image start
+	uint64_t size;
+};
+
+struct ImageHeader {
+	char magic[8];
+	uint32_t version;
+	uint8_t max_string_length;
+	uint8_t coding; // IMAGE_CODING_*
+	uint8_t reserved[2];
+	uint64_t word_count;
+	uint64_t partition_count;
+	uint64_t data_offset;
+	uint64_t data_size;
+	uint64_t image_size;
+	struct ImageSection sections[IMAGE_SECTION_MAX];
+};
+
+struct ImagePartition {
+	uint64_t offset; // from data
+	uint64_t size;   // including the zero length terminator of plain partitions
+	uint32_t word_count;
+	uint8_t length;  // of every word in the partition
+	uint8_t reserved;
+	uint16_t tier;   // 0 for the most frequent words of this length, 1 for the next ones, ...
+};
+
+struct ImageBlock {
+	uint64_t any;       // OR of the masks of the words
+	uint64_t all;       // AND of the masks of the words
+	uint64_t offset;    // of the first word, from data
+	uint8_t min_length;
+	uint8_t max_length;
+	uint8_t word_count;
+	uint8_t reserved[5];
+};
+
+struct ImageAlphabet {
+	uint32_t encoding;     // ALPHABET_*
+	uint32_t symbol_count; // codes 1 to symbol_count are used
+	uint32_t symbols[256]; // character (see alphabet_decode()) of every code
+};
+
+// Word list a shared image was built from, as it was then
+struct ImageSource {
+	uint64_t device;
+	uint64_t inode;
+	uint64_t size;
+	int64_t mtime_sec;
+	int64_t mtime_nsec;
+	uint64_t encoding; // alphabet it was built with
+};
+
+struct Image {
+	const struct ImageHeader *header;
+	const struct ImagePartition *partitions;
+	const char *data;
+	void *base;
+	size_t size;
+	uint8_t mapped;
+};
+
+// Word list read from text: one word per line, optionally followed by a tab
+// and its frequency
+struct WordList {
+	char *text;
+	const char **words;
+	uint8_t *lengths;
+	uint64_t *frequencies;
+	size_t count;
+};
+
+/* Reads the whole stream and splits it into words. Blank lines are skipped,
+ * words longer than UINT8_MAX bytes are rejected with SUGGEST_ERR_FORMAT.
+ * The padded format of dict-build (read by suggest) is recognized and read
+ * as well.
+ */
+int word_list_read (FILE *stream, struct WordList *list);
+void word_list_free (struct WordList *list);
+
+/* Splits one line (without its newline) into the word and its frequency.
+ * Returns the word length, 0 for a blank line.
+ */
+size_t word_list_line (const char *line, size_t length, uint64_t *frequency);
+
+/* Builds an image in memory with partitions of at most partition_words
+ * words, with all sections. Words are remapped to the alphabet of encoding
+ * unless it is ALPHABET_BYTES; SUGGEST_ERR_FORMAT when they have more than
+ * ALPHABET_MAX_SYMBOLS distinct characters. Words that case folding makes
+ * equal are kept once, with the highest frequency of them. IMAGE_CODING_FRONT builds a
+ * front-coded image instead, of bytes only.
+ */
+int image_build (const struct WordList *list, uint32_t partition_words, int encoding, int coding,
+				 struct Image *image);
+
+/* The word in the image equal to word, NULL if there is none or the image has
+ * no hash section. Takes one hash and one comparison.
+ */
+const char *image_find (const struct Image *image, const char *word, size_t length);
+
+/* image_find() of count words, stored into found, with the hash lookups and
+ * the word comparisons of the words interleaved (see mph_value_batch()).
+ */
+void image_find_batch (const struct Image *image, size_t count, const char *const *words, const size_t *lengths,
+					   const char **found);
+
+/* Maps an image file read-only. Returns IMAGE_NOT_IMAGE if the file does not
+ * start with IMAGE_MAGIC.
+ */
+int image_load (const char *filename, struct Image *image);
+int image_load_fd (int fd, struct Image *image);
+
+/* Maps the image of the word list filename kept in the shared memory object
+ * name (see shm_open()) read-only. The first process to get there builds it,
+ * and it is built again when the word list changes: the stale object is
+ * unlinked, processes still using it keep their mapping. Attaching to a
+ * built image checks its header and section table only, so it costs the same
+ * whatever the word count.
+ */
+int image_attach (const char *name, const char *filename, uint32_t partition_words, int encoding,
+				  struct Image *image);
+int image_write (const struct Image *image, FILE *stream);
+void image_free (struct Image *image);
+
+static inline const char *image_partition (const struct Image *image, uint64_t partition)
+{
+	return image->data + image->partitions[partition].offset;
+}
+
+/* Set of the characters of a word, folded to 64 bits. A character of one
+ * word that is missing from the other costs at least one edit, so the number
+ * of bits set in one mask and not in the other bounds the distance from below.
+ */
+static inline uint64_t image_word_mask (const char *word, size_t length)
+{
+	uint64_t mask = 0;
+	for (size_t i = 0; i < length; i++) {
+		mask |= (uint64_t)1 << ((unsigned char)word[i] & 63);
+	}
+	return mask;
+}
+
+static inline const void *image_section (const struct Image *image, int section, uint64_t *size)
+{
+	*size = image->header->sections[section].size;
+	return *size ? (const char *)image->base + image->header->sections[section].offset : NULL;
+}
+
+#endif
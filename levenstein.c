@@ -32,90 +32,314 @@
  */
  
 #include <stddef.h>
+#include <stdint.h>
+#include <limits.h>
+#include <string.h>
 #include "levenstein.h"
 
+#define LEVENSTEIN_STACK_CELLS 4096 /* uint16_t cells of the row on the stack, 8 KB */
+
 /**
  * Initial source: http://cplus.about.com/od/programmingchallenges/a/Programming-Challenge-39-Calculate-Levenshtein-Distance.htm
  * Pedro Graca, http://cplus.about.com/library/downloads/challenges/39/6.zip
  * Realization was modified by Valera Leontyev
  */
 
+/* strips the common prefix and suffix, which never change the distance */
+static void levenstein_strip(const char **a, size_t *alen,
+                             const char **b, size_t *blen) {
+  while (*alen && *blen && **a == **b) {
+    (*a)++;
+    (*b)++;
+    (*alen)--;
+    (*blen)--;
+  }
+  while (*alen && *blen && (*a)[*alen - 1] == (*b)[*blen - 1]) {
+    (*alen)--;
+    (*blen)--;
+  }
+}
+
+/* One rolling row of cell over a, the shorter string, overwritten in place
+ * as b is walked one byte at a time: the diagonal and left cells are carried
+ * in registers, only the cell above is loaded. A cell never exceeds blen, so
+ * cell only has to hold blen. */
+#define LEVENSTEIN_ROW(cell, row)                                         \
+  do {                                                                    \
+    size_t i, j;                                                          \
+    for (j = 0; j <= alen; j++) row[j] = (cell)j;                         \
+    for (i = 1; i <= blen; i++) {                                         \
+      char c = b[i - 1];                                                  \
+      size_t diag = row[0], left = i;                                     \
+      row[0] = (cell)i;                                                   \
+      for (j = 1; j <= alen; j++) {                                       \
+        size_t up = row[j];                                               \
+        size_t v = diag + (a[j - 1] != c);                                \
+        if (v > up + 1) v = up + 1;                                       \
+        if (v > left + 1) v = left + 1;                                   \
+        diag = up;                                                        \
+        left = v;                                                         \
+        row[j] = (cell)v;                                                 \
+      }                                                                   \
+    }                                                                     \
+    dist = row[alen];                                                     \
+  } while (0)
+
 size_t levenstein(const char *a, size_t alen,
-                   const char *b, size_t blen,
-                   size_t *buff, size_t bsize) {
-  size_t row, col;
-  size_t r1index = 0;
-  size_t rindex = bsize;
-
-  /* strip common prefix */
-  while (alen && blen && *a == *b) {
-    a++;
-    b++;
-    alen--;
-    blen--;
+                  const char *b, size_t blen) {
+  size_t dist;
+
+  levenstein_strip(&a, &alen, &b, &blen);
+
+  /* make a the shorter string, it sizes the row */
+  if (alen > blen) {
+    const char *s = a;
+    size_t slen = alen;
+    a = b;
+    alen = blen;
+    b = s;
+    blen = slen;
   }
+  if (alen == 0) return blen;
 
-  /* strip common suffix */
-  while (alen && blen && (a[alen - 1] == b[blen - 1])) {
-    alen--;
-    blen--;
+  if (blen <= UINT8_MAX) {
+    uint8_t row[UINT8_MAX + 1];
+    LEVENSTEIN_ROW(uint8_t, row);
+  } else if (blen <= UINT16_MAX && alen < LEVENSTEIN_STACK_CELLS) {
+    uint16_t row[LEVENSTEIN_STACK_CELLS];
+    LEVENSTEIN_ROW(uint16_t, row);
+  } else {
+    size_t *row = malloc((alen + 1) * sizeof(*row));
+    if (row == NULL) return SIZE_MAX;
+    LEVENSTEIN_ROW(size_t, row);
+    free(row);
   }
 
-  /* special case empty strings */
-  if (alen == 0) return blen;
-  if (blen == 0) return alen;
+  return dist;
+}
 
-  /* make b the bigger string (inner loop) */
-  if (blen < alen) {
-    size_t slen;
-    const char *s;
+static size_t levenstein_bounded_0(const char *a, size_t alen,
+                                   const char *b, size_t blen) {
+  return !(alen == blen && !memcmp(a, b, alen));
+}
 
-    slen = blen;
-    blen = alen;
-    alen = slen;
+/* After stripping, one substitution leaves one byte on each side and one
+ * insertion or deletion leaves a single byte on one side only */
+static size_t levenstein_bounded_1(const char *a, size_t alen,
+                                   const char *b, size_t blen) {
+  levenstein_strip(&a, &alen, &b, &blen);
+  if (alen + blen == 0) return 0;
+  if (alen <= 1 && blen <= 1) return 1;
+  return 2;
+}
 
-    s = b;
-    b = a;
-    a = s;
-  }
+/* The first remaining bytes differ, so the first edit substitutes, deletes
+ * or inserts there: distance = 1 + the best of the three rests */
+static size_t levenstein_bounded_2(const char *a, size_t alen,
+                                   const char *b, size_t blen) {
+  levenstein_strip(&a, &alen, &b, &blen);
+  if (alen + blen == 0) return 0;
+  if ((alen > blen ? alen - blen : blen - alen) > 2) return 3;
+  if (alen <= 1 && blen <= 1) return 1;
 
-  for (row = 1; row <= alen; row++) {
-    size_t r1 = row - 1;
-    for (col = 1; col <= blen; col++) {
-      size_t c1 = col - 1;
-      size_t min3v, v1, v2, v3;
-      size_t extra = 1;
-
-      if (a[r1] == b[c1]) extra = 0;
-      v1 = buff[r1index + col] + 1;
-      v2 = buff[rindex + c1] + 1;
-      v3 = buff[r1index + c1] + extra;
-      if (v1 < v2) {
-        min3v = v1<v3 ? v1 : v3;
-      } else {
-        min3v = v2<v3 ? v2 : v3;
-      }
-      buff[rindex + col] = min3v;
+  if (alen && blen && levenstein_bounded_1(a + 1, alen - 1, b + 1, blen - 1) <= 1) return 2;
+  if (alen && levenstein_bounded_1(a + 1, alen - 1, b, blen) <= 1) return 2;
+  if (blen && levenstein_bounded_1(a, alen, b + 1, blen - 1) <= 1) return 2;
+  return 3;
+}
+
+/* Banded DP for a fixed k: row i keeps the cells j = i - k .. i + k at index
+ * j - i + k, everything outside the band counts as k + 1 */
+#define LEVENSTEIN_BOUNDED(K) \
+static size_t levenstein_bounded_##K(const char *a, size_t alen, \
+                                     const char *b, size_t blen) { \
+  unsigned char rows[2][2 * K + 3]; \
+  unsigned char *prev = rows[0] + 1, *cur = rows[1] + 1, *t; \
+  size_t i; \
+  int d; \
+\
+  levenstein_strip(&a, &alen, &b, &blen); \
+  if ((alen > blen ? alen - blen : blen - alen) > K) return K + 1; \
+  if (alen == 0 || blen == 0) return alen + blen; \
+\
+  memset(rows, K + 1, sizeof rows); \
+  for (d = K; d <= 2 * K; d++) prev[d] = d - K; \
+\
+  for (i = 1; i <= alen; i++) { \
+    unsigned char row_min = K + 1; \
+    for (d = 0; d <= 2 * K; d++) { \
+      long j = (long)i + d - K; \
+      unsigned char v; \
+      if (j < 0 || j > (long)blen) { \
+        cur[d] = K + 1; \
+        continue; \
+      } \
+      if (j == 0) { \
+        v = i < K + 1 ? i : K + 1; \
+      } else { \
+        v = prev[d] + (a[i - 1] != b[j - 1]); \
+        if (v > prev[d + 1] + 1) v = prev[d + 1] + 1; \
+        if (v > cur[d - 1] + 1) v = cur[d - 1] + 1; \
+        if (v > K + 1) v = K + 1; \
+      } \
+      cur[d] = v; \
+      if (row_min > v) row_min = v; \
+    } \
+    if (row_min > K) return K + 1; \
+    t = prev; prev = cur; cur = t; \
+  } \
+\
+  return prev[(long)blen - (long)alen + K]; \
+}
+
+LEVENSTEIN_BOUNDED(3)
+LEVENSTEIN_BOUNDED(4)
+LEVENSTEIN_BOUNDED(5)
+LEVENSTEIN_BOUNDED(6)
+LEVENSTEIN_BOUNDED(7)
+LEVENSTEIN_BOUNDED(8)
+
+levenstein_kernel levenstein_select(long k) {
+  static const levenstein_kernel kernels[LEVENSTEIN_MAX_BOUNDED + 1] = {
+    levenstein_bounded_0, levenstein_bounded_1, levenstein_bounded_2,
+    levenstein_bounded_3, levenstein_bounded_4, levenstein_bounded_5,
+    levenstein_bounded_6, levenstein_bounded_7, levenstein_bounded_8
+  };
+
+  if (k < 0 || k > LEVENSTEIN_MAX_BOUNDED) return NULL;
+  return kernels[k];
+}
+
+/* Optimal string alignment DP over three rows of the shorter string a, for
+ * strings too long for the bit vectors. The rows of a dictionary word fit on
+ * the stack; longer strings take them from the heap, like levenstein(), and
+ * get SIZE_MAX when there is not enough memory */
+static size_t levenstein_osa_rows(const char *a, size_t alen,
+                                  const char *b, size_t blen) {
+  size_t stack[3][UINT8_MAX + 1];
+  size_t *heap = NULL, *prev2 = stack[0], *prev = stack[1], *cur = stack[2], *t;
+  size_t i, j, dist;
+
+  if (alen > UINT8_MAX) {
+    heap = malloc(3 * (alen + 1) * sizeof(*heap));
+    if (heap == NULL) return SIZE_MAX;
+    prev2 = heap;
+    prev = heap + alen + 1;
+    cur = heap + 2 * (alen + 1);
+  }
+  for (j = 0; j <= alen; j++) prev[j] = j;
+  for (i = 1; i <= blen; i++) {
+    cur[0] = i;
+    for (j = 1; j <= alen; j++) {
+      size_t v = prev[j - 1] + (b[i - 1] != a[j - 1]);
+      if (v > prev[j] + 1) v = prev[j] + 1;
+      if (v > cur[j - 1] + 1) v = cur[j - 1] + 1;
+      if (i > 1 && j > 1 && b[i - 1] == a[j - 2] && b[i - 2] == a[j - 1]
+          && v > prev2[j - 2] + 1) v = prev2[j - 2] + 1;
+      cur[j] = v;
     }
-    rindex += bsize;
-    r1index += bsize;
+    t = prev2; prev2 = prev; prev = cur; cur = t;
   }
 
-  return buff[alen * bsize + blen];
+  dist = prev[alen];
+  free(heap);
+  return dist;
 }
 
-size_t* levenstein_init_buffer(size_t size) {
-  size_t j, *buff = NULL;
-  buff = malloc((size + 1) * (size + 1) * sizeof *buff);
-  assert(buff != NULL && "Not enough memory");
-  *buff = 0;
-  for (j = 1; j <= size; j++) {
-    buff[j] = buff[j * (size + 1)] = j;
+/* Myers' bit vectors with Hyyro's transposition term: bit i of the vectors
+ * holds the vertical delta of row i + 1 of the current column, b is walked
+ * one column per byte, and TR marks the cells where a swap of the last two
+ * bytes of b matches a[i - 1..i] */
+size_t levenstein_osa(const char *a, size_t alen,
+                      const char *b, size_t blen) {
+  uint64_t peq[UCHAR_MAX + 1];
+  uint64_t vp, vn = 0, d0 = 0, pm_prev = 0, last;
+  size_t i, dist;
+
+  if (alen > blen) {
+    const char *s = a;
+    size_t slen = alen;
+    a = b;
+    alen = blen;
+    b = s;
+    blen = slen;
+  }
+  if (alen == 0) return blen;
+  if (alen > 64) return levenstein_osa_rows(a, alen, b, blen);
+
+  /* only the entries that will be read are cleared */
+  for (i = 0; i < alen; i++) peq[(unsigned char)a[i]] = 0;
+  for (i = 0; i < blen; i++) peq[(unsigned char)b[i]] = 0;
+  for (i = 0; i < alen; i++) peq[(unsigned char)a[i]] |= (uint64_t)1 << i;
+
+  vp = alen == 64 ? ~(uint64_t)0 : ((uint64_t)1 << alen) - 1;
+  last = (uint64_t)1 << (alen - 1);
+  dist = alen;
+  for (i = 0; i < blen; i++) {
+    uint64_t pm = peq[(unsigned char)b[i]];
+    uint64_t tr = ((~d0 & pm) << 1) & pm_prev;
+    uint64_t hp, hn;
+    d0 = (((pm & vp) + vp) ^ vp) | pm | vn | tr;
+    hp = vn | ~(d0 | vp);
+    hn = d0 & vp;
+    if (hp & last) dist++;
+    else if (hn & last) dist--;
+    hp = (hp << 1) | 1;
+    hn <<= 1;
+    vp = hn | ~(d0 | hp);
+    vn = hp & d0;
+    pm_prev = pm;
   }
 
-  return buff;
+  return dist;
 }
 
-void levenstein_free_buffer(size_t* buff) {
-  free(buff);
-}
\ No newline at end of file
+/* Banded DP like the bounded kernels, with the band as wide as the
+ * insertions and deletions that k affords: row i keeps the cells
+ * j = i - w .. i + w at index j - i + w, everything outside the band counts
+ * as k + 1. Both strings fit in UINT8_MAX bytes, so neither does the band */
+size_t levenstein_weighted(const struct LevensteinCosts *costs, long k,
+                           const char *a, size_t alen,
+                           const char *b, size_t blen) {
+  uint16_t rows[2][2 * UINT8_MAX + 3];
+  uint16_t *prev = rows[0] + 1, *cur = rows[1] + 1, *t;
+  unsigned unit = costs->unit, size = costs->size, limit = (unsigned)k + 1;
+  long w = k / unit, d;
+  size_t i;
+
+  if ((alen > blen ? alen - blen : blen - alen) > (size_t)w) return limit;
+  if (w > UINT8_MAX) w = UINT8_MAX;
+
+  for (d = 0; d < 2 * w + 3; d++) rows[0][d] = rows[1][d] = limit;
+  for (d = w; d <= 2 * w && d - w <= (long)blen; d++) prev[d] = (d - w) * unit;
+
+  for (i = 1; i <= alen; i++) {
+    unsigned x = (unsigned char)a[i - 1];
+    /* Bytes without a row of their own cost unit against all but themselves */
+    const unsigned char *substitution = x < size ? costs->substitution + x * size : NULL;
+    unsigned row_min = limit;
+    for (d = 0; d <= 2 * w; d++) {
+      long j = (long)i + d - w;
+      unsigned v;
+      if (j < 0 || j > (long)blen) {
+        cur[d] = limit;
+        continue;
+      }
+      if (j == 0) {
+        v = i * unit < limit ? i * unit : limit;
+      } else {
+        unsigned y = (unsigned char)b[j - 1];
+        v = prev[d] + (substitution && y < size ? substitution[y] : x == y ? 0 : unit);
+        if (v > prev[d + 1] + unit) v = prev[d + 1] + unit;
+        if (v > cur[d - 1] + unit) v = cur[d - 1] + unit;
+        if (v > limit) v = limit;
+      }
+      cur[d] = v;
+      if (row_min > v) row_min = v;
+    }
+    if (row_min > (unsigned)k) return limit;
+    t = prev; prev = cur; cur = t;
+  }
+
+  return prev[(long)blen - (long)alen + w];
+}
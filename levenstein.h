@@ -36,31 +36,73 @@
 
 #include <stddef.h>
 #include <stdlib.h>
+#include <limits.h>
 #include <assert.h>
 
-/* Calculates the levenstein distance between sleft and srite
- * nleft and nrite are the lengths of the sleft and srite strings
- * buff should point to a square array of size bsize * bsize
- * with the first row initialized with 0, 1, 2, 3, etc
- * and the first column with 0, 1, 2, 3 etc (the 0 is the same as for the row)
- *
- * 0 1 2 3 4 ... (bsize - 1)
- * 1
- * 2
- * ...
- * (bsize - 1)
- *
- * the function does not write to these initial values
+/* Calculates the levenstein distance between a and b, alen and blen being
+ * their lengths. One rolling row over the shorter string is kept on the
+ * stack, in uint8_t cells when both strings are at most UINT8_MAX bytes long
+ * (the whole working set is then 256 bytes), in uint16_t cells up to
+ * UINT16_MAX bytes when the shorter one is under 4096 bytes. Other strings
+ * take their row from the heap and get SIZE_MAX when there is not enough
+ * memory. Reentrant, needs no buffer, and fits levenstein_kernel below.
  *
  * If any pointer parameter is NULL the behaviour is undefined
- * If `buff` is not bsize*bsize the behaviour is undefined
  */
 size_t levenstein(const char *a, size_t alen,
-                   const char *b, size_t blen,
-                   size_t *buff, size_t bsize);
+                  const char *b, size_t blen);
+
+/* Bounded kernels: each one is specialized for a fixed threshold k and
+ * returns the levenstein distance between a and b when it is at most k,
+ * or k + 1 when it is greater.
+ *
+ * k = 0 is a comparison, k = 1 a single linear walk, k = 2 tries the three
+ * possible first edits and finishes each with the k = 1 walk, larger k up to
+ * LEVENSTEIN_MAX_BOUNDED run the DP over the 2k + 1 diagonals band only and
+ * give up as soon as a whole row exceeds k.
+ */
+typedef size_t (*levenstein_kernel)(const char *a, size_t alen,
+                                    const char *b, size_t blen);
 
-size_t* levenstein_init_buffer(size_t size);
+#define LEVENSTEIN_MAX_BOUNDED 8
 
-void levenstein_free_buffer(size_t* buff);
+/* Returns the kernel for threshold k, NULL if k is negative or greater than
+ * LEVENSTEIN_MAX_BOUNDED */
+levenstein_kernel levenstein_select(long k);
+
+/* Optimal string alignment (restricted Damerau) distance: as levenstein(),
+ * but swapping two adjacent bytes costs one edit, and no substring is edited
+ * again after a swap. Bit-parallel (Hyyro 2003) when the shorter string is at
+ * most 64 bytes, costing a few word operations per byte of the longer one,
+ * a three row DP otherwise, with its rows on the heap past UINT8_MAX bytes
+ * (SIZE_MAX when there is not enough memory). Fits levenstein_kernel (for any
+ * threshold), like levenstein().
+ */
+size_t levenstein_osa(const char *a, size_t alen,
+                      const char *b, size_t blen);
+
+/* Costs of a weighted distance over bytes below size: substituting y for x
+ * costs substitution[x * size + y] (0 on the diagonal), inserting or deleting
+ * a byte costs unit (at least 1), and so does substituting any byte from size
+ * on. The table has size * size entries, so a small alphabet keeps it in a few
+ * cache lines. min is the cheapest edit of all, so a distance of at most k
+ * takes at most k / min edits. */
+struct LevensteinCosts {
+  unsigned char unit;
+  unsigned char min;
+  unsigned short size; /* 1 to UCHAR_MAX + 1 */
+  unsigned char substitution[];
+};
+
+/* Weighted distance between a and b, both at most UINT8_MAX bytes long,
+ * bounded like the kernels above: the distance when it is at most k, k + 1
+ * when it is greater. The DP runs over the band of the k / unit diagonals on
+ * either side of the main one only, with the substitution row of every byte
+ * of a read from the table, and gives up as soon as a whole row exceeds k.
+ * k is below UINT8_MAX, like the distances libsuggest reports.
+ */
+size_t levenstein_weighted(const struct LevensteinCosts *costs, long k,
+                           const char *a, size_t alen,
+                           const char *b, size_t blen);
 
 #endif
@@ -0,0 +1,2004 @@
+/** 
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2013, Valera Leontyev.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *  - this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *  - this list of conditions and the following disclaimer in the documentation
+ *  - and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of the Valera Leontyev nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "libsuggest.h"
+#include "levenstein.h"
+#include "image.h"
+#include "stream.h"
+#include "probes.h"
+
+#define ENGINE_CHOICES (LEVENSTEIN_MAX_BOUNDED + 2) // one per bounded max_lev_diff, one for all larger ones
+#define ENGINE_KERNELS 3                           // plain, damerau and weighted distances, each with its choices
+
+struct SuggestContext {
+	struct Image image;
+	uint64_t partition_count;
+
+	// Columnar view, NULL for images without it
+	const uint8_t *lengths;
+	const uint64_t *offsets;
+	const uint64_t *masks;
+	uint64_t *first_words; // index of the first word of every partition in the columns
+
+	// Block summaries, NULL for images without them
+	const struct ImageBlock *blocks;
+	uint64_t *first_blocks; // index of the first block of every partition
+	uint64_t block_count;
+	uint8_t front_coded;    // words are decoded block by block (see IMAGE_CODING_FRONT), results point at them coded
+
+	// Alphabet of images of remapped words, NULL (and no spellings) for images of bytes
+	const struct ImageAlphabet *alphabet;
+	struct AlphabetMap alphabet_map;
+	const uint64_t *spellings; // IMAGE_SECTION_SPELLINGS
+	uint64_t spellings_size;
+
+	// Edit costs of weighted queries, compiled from the cost file, NULL without one
+	struct LevensteinCosts *costs;
+
+	int engines[ENGINE_KERNELS * ENGINE_CHOICES]; // engine picked by suggest_calibrate() per distance and
+	                                              // max_lev_diff, plus one, 0 until calibrated
+};
+
+// Results
+
+struct Result {
+	const char *word;
+	uint8_t length;
+	uint8_t distance;
+};
+
+struct ResultList {
+	struct Result *items;
+	size_t count;
+	size_t capacity;
+};
+
+static int result_append (struct ResultList *results, const char *word, uint8_t length, uint8_t distance);
+
+// Dict
+
+static int load_dict (const char *filename, struct SuggestContext *ctx, const struct SuggestOptions *opts);
+static void unload_dict (struct SuggestContext *ctx);
+static int context_remap (const struct SuggestContext *ctx, const char **word, size_t *length, char *codes);
+static const char *context_find (const struct SuggestContext *ctx, const char *word, size_t length);
+static const char *context_spelling (const struct SuggestContext *ctx, const char *word, size_t *length);
+static const char *context_decode (const struct SuggestContext *ctx, const char *entry, char *word, size_t *length);
+static int64_t context_word_index (const struct SuggestContext *ctx, const char *word);
+
+#define COSTS_DEFAULT_UNIT 2
+#define COSTS_LINE_MAX 256
+
+static int load_costs (const char *filename, struct SuggestContext *ctx);
+static int costs_code (const struct SuggestContext *ctx, const char *character, unsigned char *code);
+
+// Query
+
+#define DEADLINE_CHECK_WORDS 256
+#define CONTAINS_BATCH 64 // words per image_find_batch() call of suggest_contains_batch()
+
+struct Query {
+	const struct SuggestContext *ctx;
+	const char *word;
+	size_t word_len;
+	const struct SuggestParams *params;
+	const struct Engine *engine;
+	levenstein_kernel kernel; // bounded kernel for max_lev_diff, or levenstein() for the full DP
+	const struct LevensteinCosts *costs; // levenstein_weighted() instead of the kernel, NULL when unweighted
+	short max_edits;          // edits max_lev_diff affords: fewer when they are weighted,
+	short max_indels;         // fewer still for insertions and deletions
+	uint64_t mask;            // image_word_mask() of word
+	uint64_t *schedule; // partitions in scan order, most promising first
+	uint64_t scheduled;
+	uint64_t scheduled_words;
+	struct ResultList *results; // one list per schedule slot
+	uint8_t has_deadline;
+	struct timespec deadline;
+	int expired;
+};
+
+// One scan over the schedules of several queries (one per dictionary layer)
+// by one set of workers
+struct PassSlot {
+	uint16_t tier;
+	uint8_t length_diff;
+	uint32_t query;
+	uint64_t slot; // in the schedule of the query
+};
+
+struct Pass {
+	struct Query *queries;
+	struct PassSlot *slots; // most promising first, like a schedule
+	uint64_t scheduled;
+	uint64_t next;          // next slot to scan, taken atomically
+};
+
+struct Worker {
+	struct Query *query; // of the slot being scanned
+	int error;
+	pthread_t thread;
+	unsigned index;
+	struct Pass *pass;
+};
+
+static int print_closest (const struct SuggestContext *ctx, const char *word, const struct SuggestParams *params,
+						  struct Query *query);
+static int print_closest_schedule (const struct SuggestContext *ctx, const char *word,
+								   const struct SuggestParams *params, struct Query *query);
+static int query_schedule (const struct SuggestContext *ctx, const char *word, const struct SuggestParams *params,
+						   struct Query *query);
+static int print_closest_fork (struct Query *queries, size_t count);
+static int pass_slot_compare (const void *a, const void *b);
+static void *print_closest_worker (void *arg);
+static int print_closest_partition (struct Worker *worker, struct ResultList *results, uint64_t partition);
+static int print_closest_iterations (struct Worker *worker, struct ResultList *results, const char *offset,
+									 size_t limit);
+static int print_closest_decoded (struct Worker *worker, struct ResultList *results, const struct ImageBlock *block);
+static int query_skips_block (const struct Query *query, const struct ImageBlock *block);
+static int print_closest_columns (struct Worker *worker, struct ResultList *results, uint64_t partition);
+static uint64_t columns_prefilter (const uint64_t *masks, size_t count, uint64_t mask, short max_lev_diff);
+static int print_closest_segment (struct ResultList *results, const struct Query *query, const char *local_word,
+								  uint8_t local_word_length);
+static size_t segment_distance (const struct Query *query, const char *local_word, uint8_t local_word_length);
+static int query_usable (const struct SuggestParams *params, size_t length);
+static int query_weighted_usable (const struct SuggestContext *ctx, const struct SuggestParams *params, size_t length);
+static void query_set_deadline (struct Query *query, long deadline_us);
+static int query_expired (struct Query *query);
+
+// Engines
+
+#define ENGINE_CALIBRATION_MIN_WORDS 65536 // below that many words to scan the first usable engine is taken
+#define ENGINE_CALIBRATION_WORDS 16384     // words scanned by every usable engine when calibrating
+
+/* An engine scans one partition for a query. Engines are listed in order of
+ * preference: without suggest_calibrate() the first usable one is taken.
+ */
+struct Engine {
+	const char *name;
+	uint8_t bounded; // compares with the levenstein_select() kernel when there is one
+	int (*usable) (const struct SuggestContext *ctx, const struct SuggestParams *params);
+	int (*scan) (struct Worker *worker, struct ResultList *results, uint64_t partition);
+};
+
+static int engine_select (struct Query *query);
+static size_t engine_choice (const struct SuggestParams *params);
+static int engine_calibrate (struct Query *query, const struct Engine *engine, double *seconds);
+static void engine_use (struct Query *query, const struct Engine *engine);
+static int engine_columnar_usable (const struct SuggestContext *ctx, const struct SuggestParams *params);
+static int engine_bounded_usable (const struct SuggestContext *ctx, const struct SuggestParams *params);
+static int engine_classic_usable (const struct SuggestContext *ctx, const struct SuggestParams *params);
+
+static const struct Engine engines[] = {
+	{ "columnar", 1, engine_columnar_usable, print_closest_columns },   // character set prefilter over the columns
+	{ "bounded",  1, engine_bounded_usable,  print_closest_partition }, // threshold specialized kernels
+	{ "classic",  0, engine_classic_usable,  print_closest_partition }, // full levenstein DP
+};
+#define ENGINE_COUNT (sizeof(engines) / sizeof(*engines))
+
+// Streaming
+
+#define STREAM_LINE_MAX 4096 // longest line carried over from one block to the next
+
+struct StreamScan {
+	struct Query query;
+	struct ResultList results;
+	char carry[STREAM_LINE_MAX]; // start of a line cut by the end of the previous block
+	size_t carry_length;
+	unsigned words;
+};
+
+static int stream_scan_block (struct StreamScan *scan, const char *block, size_t size, size_t *tail);
+static int stream_scan_line (struct StreamScan *scan, const char *line, size_t length);
+
+// Sessions
+
+struct SuggestSession {
+	const struct SuggestContext *ctx;
+	struct SuggestParams params;
+	size_t query_length;
+	uint64_t count;    // candidates left, every word before the first character
+	uint64_t *offsets; // of the candidates' words (from data), in data order
+	uint8_t *rows;     // last DP row of every candidate, its length + 1 cells each, saturated at max_lev_diff + 1
+};
+
+static void session_extend (struct SuggestSession *session, char c);
+static void session_start (struct SuggestSession *session, char c);
+static int session_row (uint8_t *row, const char *word, uint8_t length, char c, size_t query_length, uint8_t limit);
+
+// Completion
+
+struct Completer {
+	const char *data;
+	const uint64_t *sorted;
+	size_t word_count;
+	const char *prefix;
+	size_t prefix_len;
+	short max_lev_diff;
+	size_t limit;
+	uint16_t *rows; // (UINT8_MAX + 1) rows of prefix_len + 1 cells
+	uint16_t best[UINT8_MAX + 1];
+};
+
+static int print_completions (struct Completer *completer, struct ResultList *results);
+static size_t completion_skip (const struct Completer *completer, size_t from, const char *word, size_t depth);
+static int completion_repeats (const struct Completer *completer, size_t i);
+static int completion_offer (const struct Completer *completer, struct ResultList *results, const char *word,
+							 uint8_t length, uint8_t distance);
+static short completion_bound (const struct Completer *completer, const struct ResultList *results);
+static int completion_compare (const void *a, const void *b);
+
+// API
+
+void suggest_default_options (struct SuggestOptions *opts)
+{
+	opts->partition_words = IMAGE_PARTITION_WORDS;
+	opts->shared_name = NULL;
+	opts->alphabet = NULL;
+	opts->costs = NULL;
+}
+
+void suggest_default_params (struct SuggestParams *params)
+{
+	params->max_length_diff = 5;
+	params->max_lev_diff = 5;
+	params->threads = 4;
+	params->deadline_us = 0;
+	params->engine = NULL;
+	params->exact_first = 0;
+	params->damerau = 0;
+	params->weighted = 0;
+}
+
+struct SuggestContext *suggest_open (const char *dict_path, const struct SuggestOptions *opts, int *error)
+{
+	int r = SUGGEST_OK;
+	struct SuggestContext *ctx = NULL;
+
+	if (!dict_path || !opts || !opts->partition_words || (opts->alphabet && alphabet_encoding(opts->alphabet) < 0)) {
+		r = SUGGEST_ERR_ARGUMENT;
+	} else if (!(ctx = calloc(1, sizeof(*ctx)))) {
+		r = SUGGEST_ERR_NOMEM;
+	} else if ((r = load_dict(dict_path, ctx, opts)) != SUGGEST_OK) {
+		free(ctx);
+		ctx = NULL;
+	}
+
+	if (error) {
+		*error = r;
+	}
+	return ctx;
+}
+
+void suggest_close (struct SuggestContext *ctx)
+{
+	if (ctx) {
+		unload_dict(ctx);
+		free(ctx);
+	}
+}
+
+int suggest_calibrate (struct SuggestContext *ctx, const char *word, const struct SuggestParams *params)
+{
+	if (!ctx || !word || !params) {
+		return SUGGEST_ERR_ARGUMENT;
+	}
+
+	char codes[UINT8_MAX + 1];
+	size_t length = strlen(word);
+	int r = context_remap(ctx, &word, &length, codes);
+	if (r != SUGGEST_OK) {
+		return r;
+	}
+	if (!query_usable(params, length) || (params->weighted && !query_weighted_usable(ctx, params, length))) {
+		return SUGGEST_ERR_ARGUMENT;
+	}
+
+	struct Query query;
+	r = query_schedule(ctx, word, params, &query);
+
+	// Too little to scan for calibration to pay off: the first usable engine
+	// stays the choice
+	const struct Engine *best = NULL;
+	double best_seconds = 0;
+	for (size_t i = 0; r == SUGGEST_OK && query.scheduled_words >= ENGINE_CALIBRATION_MIN_WORDS
+			 && i < ENGINE_COUNT; i++) {
+		double seconds;
+		if (!engines[i].usable(ctx, params) || (r = engine_calibrate(&query, &engines[i], &seconds)) != SUGGEST_OK) {
+			continue;
+		}
+		if (!best || seconds < best_seconds) {
+			best = &engines[i];
+			best_seconds = seconds;
+		}
+	}
+	if (best) {
+		ctx->engines[engine_choice(params)] = (int)(best - engines) + 1;
+	}
+	free(query.results);
+	free(query.schedule);
+
+	return r;
+}
+
+int suggest_query (const struct SuggestContext *ctx, const char *word, const struct SuggestParams *params,
+				   suggest_callback callback, void *user_data)
+{
+	if (!ctx || !word || !params || !callback || !params->threads) {
+		return SUGGEST_ERR_ARGUMENT;
+	}
+
+	char codes[UINT8_MAX + 1];
+	size_t length = strlen(word);
+	int r = context_remap(ctx, &word, &length, codes);
+	if (r != SUGGEST_OK) {
+		return r;
+	}
+	if (!query_usable(params, length) || (params->weighted && !query_weighted_usable(ctx, params, length))) {
+		return SUGGEST_ERR_ARGUMENT;
+	}
+
+	if (params->exact_first) {
+		uint64_t size;
+		if (!image_section(&ctx->image, IMAGE_SECTION_HASH, &size) && ctx->image.header->word_count) {
+			return SUGGEST_ERR_FORMAT;
+		}
+		const char *found = image_find(&ctx->image, word, length);
+		if (found) {
+			found = context_spelling(ctx, found, &length);
+			callback(found, length, 0, user_data);
+			return SUGGEST_OK;
+		}
+	}
+
+	struct Query query;
+	r = print_closest(ctx, word, params, &query);
+	if (r == SUGGEST_OK && query.expired) {
+		r = SUGGEST_PARTIAL;
+	}
+	size_t reported = 0;
+	char decoded[UINT8_MAX + 1];
+	for (uint64_t i = 0; i < query.scheduled; i++) {
+		for (size_t j = 0; r >= SUGGEST_OK && j < query.results[i].count; j++) {
+			struct Result *result = &query.results[i].items[j];
+			const char *spelling = ctx->front_coded ? context_decode(ctx, result->word, decoded, &length)
+				: context_spelling(ctx, result->word, &length);
+			PROBE_RESULT(spelling, length, result->distance);
+			callback(spelling, length, result->distance, user_data);
+			reported++;
+		}
+		free(query.results[i].items);
+	}
+	free(query.results);
+	free(query.schedule);
+	PROBE_QUERY_END(word, reported, r);
+
+	return r;
+}
+
+int suggest_query_layers (const struct SuggestLayer *layers, size_t count, const char *word,
+						  const struct SuggestParams *params, suggest_callback callback, void *user_data)
+{
+	if (!layers || !count || !word || !params || !callback || !params->threads) {
+		return SUGGEST_ERR_ARGUMENT;
+	}
+	for (size_t i = 0; i < count; i++) {
+		uint64_t size;
+		char codes[UINT8_MAX + 1];
+		const char *layer_word = word;
+		size_t length = strlen(word);
+		if (!layers[i].ctx || context_remap(layers[i].ctx, &layer_word, &length, codes) != SUGGEST_OK
+			|| !query_usable(params, length)
+			|| (params->weighted && !query_weighted_usable(layers[i].ctx, params, length))) {
+			return SUGGEST_ERR_ARGUMENT;
+		}
+		if ((!image_section(&layers[i].ctx->image, IMAGE_SECTION_HASH, &size) && layers[i].ctx->image.header->word_count)
+			|| (layers[i].tombstones && !image_section(&layers[i].tombstones->image, IMAGE_SECTION_HASH, &size)
+				&& layers[i].tombstones->image.header->word_count)) {
+			return SUGGEST_ERR_FORMAT;
+		}
+	}
+
+	if (params->exact_first) {
+		size_t length = strlen(word);
+		for (size_t i = count; i-- > 0;) {
+			const char *found = context_find(layers[i].ctx, word, length);
+			if (found) {
+				found = context_spelling(layers[i].ctx, found, &length);
+				callback(found, length, 0, user_data);
+				return SUGGEST_OK;
+			}
+			if (layers[i].tombstones && context_find(layers[i].tombstones, word, length)) {
+				break;
+			}
+		}
+	}
+
+	// Query q is on layer count - 1 - q, so the last layers win the ties of the pass
+	struct Query *queries = calloc(count, sizeof(*queries));
+	char (*codes)[UINT8_MAX + 1] = malloc(count * sizeof(*codes));
+	int r = queries && codes ? SUGGEST_OK : SUGGEST_ERR_NOMEM;
+	for (size_t q = 0; q < count && r == SUGGEST_OK; q++) {
+		const char *layer_word = word;
+		size_t length = strlen(word);
+		r = context_remap(layers[count - 1 - q].ctx, &layer_word, &length, codes[q]);
+		if (r == SUGGEST_OK) {
+			r = print_closest_schedule(layers[count - 1 - q].ctx, layer_word, params, &queries[q]);
+			queries[q].deadline = queries[0].deadline;
+		}
+	}
+	if (r == SUGGEST_OK) {
+		r = print_closest_fork(queries, count);
+	}
+	for (size_t q = 0; queries && q < count; q++) {
+		if (r == SUGGEST_OK && queries[q].expired) {
+			r = SUGGEST_PARTIAL;
+		}
+	}
+
+	// A word is reported from the last layer that has it, unless the
+	// tombstones of a later layer remove it
+	for (size_t q = 0; queries && q < count; q++) {
+		size_t layer = count - 1 - q;
+		size_t reported = 0;
+		for (uint64_t i = 0; i < queries[q].scheduled; i++) {
+			for (size_t j = 0; r >= SUGGEST_OK && j < queries[q].results[i].count; j++) {
+				struct Result *result = &queries[q].results[i].items[j];
+				size_t length;
+				const char *spelling = context_spelling(layers[layer].ctx, result->word, &length);
+				int hidden = 0;
+				for (size_t later = layer + 1; later < count && !hidden; later++) {
+					hidden = context_find(layers[later].ctx, spelling, length)
+						|| (layers[later].tombstones && context_find(layers[later].tombstones, spelling, length));
+				}
+				if (!hidden) {
+					PROBE_RESULT(spelling, length, result->distance);
+					callback(spelling, length, result->distance, user_data);
+					reported++;
+				}
+			}
+			free(queries[q].results[i].items);
+		}
+		free(queries[q].results);
+		free(queries[q].schedule);
+		PROBE_QUERY_END(word, reported, r);
+	}
+	free(queries);
+	free(codes);
+
+	return r;
+}
+
+int suggest_contains (const struct SuggestContext *ctx, const char *word)
+{
+	uint64_t size;
+	if (!ctx || !word) {
+		return SUGGEST_ERR_ARGUMENT;
+	}
+	if (!image_section(&ctx->image, IMAGE_SECTION_HASH, &size)) {
+		return ctx->image.header->word_count ? SUGGEST_ERR_FORMAT : 0;
+	}
+	return context_find(ctx, word, strlen(word)) != NULL;
+}
+
+int suggest_contains_batch (const struct SuggestContext *ctx, const char *const *words, size_t count, uint8_t *found)
+{
+	uint64_t size;
+	if (!ctx || (count && (!words || !found))) {
+		return SUGGEST_ERR_ARGUMENT;
+	}
+	if (!image_section(&ctx->image, IMAGE_SECTION_HASH, &size)) {
+		if (ctx->image.header->word_count) {
+			return SUGGEST_ERR_FORMAT;
+		}
+		memset(found, 0, count);
+		return SUGGEST_OK;
+	}
+
+	size_t lengths[CONTAINS_BATCH];
+	const char *batch_words[CONTAINS_BATCH];
+	const char *words_found[CONTAINS_BATCH];
+	char (*codes)[UINT8_MAX + 1] = NULL;
+	if (ctx->alphabet && !(codes = malloc(CONTAINS_BATCH * sizeof(*codes)))) {
+		return SUGGEST_ERR_NOMEM;
+	}
+	for (size_t first = 0; first < count; first += CONTAINS_BATCH) {
+		size_t batch = count - first < CONTAINS_BATCH ? count - first : CONTAINS_BATCH;
+		for (size_t i = 0; i < batch; i++) {
+			if (!(batch_words[i] = words[first + i])) {
+				free(codes);
+				return SUGGEST_ERR_ARGUMENT;
+			}
+			lengths[i] = strlen(batch_words[i]);
+			if (codes && context_remap(ctx, &batch_words[i], &lengths[i], codes[i]) != SUGGEST_OK) {
+				batch_words[i] = ""; // more characters than any word: found nowhere, like the empty word
+				lengths[i] = 0;
+			}
+		}
+		image_find_batch(&ctx->image, batch, batch_words, lengths, words_found);
+		for (size_t i = 0; i < batch; i++) {
+			found[first + i] = words_found[i] != NULL;
+		}
+	}
+	free(codes);
+	return SUGGEST_OK;
+}
+
+int64_t suggest_word_index (const struct SuggestContext *ctx, const char *word)
+{
+	if (!ctx || !word) {
+		return SUGGEST_ERR_ARGUMENT;
+	}
+	if (!ctx->offsets) {
+		return ctx->image.header->word_count ? SUGGEST_ERR_FORMAT : SUGGEST_ERR_ARGUMENT;
+	}
+	if (!ctx->spellings) {
+		return context_word_index(ctx, word);
+	}
+
+	// Words are reported as their spellings, whose offsets grow in data order too
+	const char *spellings = (const char *)ctx->spellings;
+	if (word <= spellings || word > spellings + ctx->spellings_size) {
+		return SUGGEST_ERR_ARGUMENT;
+	}
+	uint64_t offset = word - spellings - sizeof(uint8_t);
+	uint64_t low = 0, high = ctx->image.header->word_count;
+	while (low < high) {
+		uint64_t middle = low + (high - low) / 2;
+		if (ctx->spellings[middle] < offset) {
+			low = middle + 1;
+		} else {
+			high = middle;
+		}
+	}
+	if (low == ctx->image.header->word_count || ctx->spellings[low] != offset) {
+		return SUGGEST_ERR_ARGUMENT;
+	}
+	return (int64_t)low;
+}
+
+const char *suggest_word (const struct SuggestContext *ctx, uint64_t index, size_t *length)
+{
+	if (!ctx || !ctx->offsets || index >= ctx->image.header->word_count) {
+		return NULL;
+	}
+	if (ctx->spellings) {
+		const char *spelling = (const char *)ctx->spellings + ctx->spellings[index];
+		if (length) {
+			*length = (uint8_t)*spelling;
+		}
+		return spelling + sizeof(uint8_t);
+	}
+	if (length) {
+		*length = ctx->lengths[index];
+	}
+	return ctx->image.data + ctx->offsets[index] + sizeof(uint8_t);
+}
+
+int suggest_complete (const struct SuggestContext *ctx, const char *prefix, const struct SuggestParams *params,
+					  size_t limit, suggest_callback callback, void *user_data)
+{
+	if (!ctx || !prefix || !params || !callback || params->damerau || params->weighted || params->max_lev_diff < 0) {
+		return SUGGEST_ERR_ARGUMENT;
+	}
+	if (!limit) {
+		return SUGGEST_OK;
+	}
+
+	uint64_t sorted_size;
+	struct Completer completer;
+	completer.data = ctx->image.data;
+	completer.sorted = image_section(&ctx->image, IMAGE_SECTION_SORTED, &sorted_size);
+	completer.word_count = sorted_size / sizeof(uint64_t);
+	char codes[UINT8_MAX + 1];
+	completer.prefix = prefix;
+	completer.prefix_len = strlen(prefix);
+	completer.max_lev_diff = params->max_lev_diff;
+	completer.limit = limit;
+	if (completer.prefix_len > UINT8_MAX
+		|| context_remap(ctx, &completer.prefix, &completer.prefix_len, codes) != SUGGEST_OK) {
+		return SUGGEST_ERR_ARGUMENT;
+	}
+	if (!completer.sorted) {
+		return SUGGEST_ERR_FORMAT;
+	}
+	completer.rows = malloc((UINT8_MAX + 1) * (completer.prefix_len + 1) * sizeof(uint16_t));
+	if (!completer.rows) {
+		return SUGGEST_ERR_NOMEM;
+	}
+
+	struct ResultList results = { NULL, 0, 0 };
+	int r = print_completions(&completer, &results);
+	free(completer.rows);
+
+	if (r == SUGGEST_OK) {
+		qsort(results.items, results.count, sizeof(*results.items), completion_compare);
+		for (size_t i = 0; i < results.count; i++) {
+			size_t length;
+			const char *spelling = context_spelling(ctx, results.items[i].word, &length);
+			callback(spelling, length, results.items[i].distance, user_data);
+		}
+	}
+	free(results.items);
+
+	return r;
+}
+
+int suggest_stream_query (const char *dict_path, const char *word, const struct SuggestParams *params,
+						  suggest_callback callback, void *user_data)
+{
+	if (!dict_path || !word || !params || !callback || params->weighted || !query_usable(params, strlen(word))) {
+		return SUGGEST_ERR_ARGUMENT;
+	}
+
+	struct StreamScan *scan = calloc(1, sizeof(*scan));
+	if (!scan) {
+		return SUGGEST_ERR_NOMEM;
+	}
+	scan->query.word = word;
+	scan->query.word_len = strlen(word);
+	scan->query.params = params;
+	scan->query.kernel = params->damerau ? levenstein_osa : levenstein_select(params->max_lev_diff);
+	if (!scan->query.kernel) {
+		scan->query.kernel = levenstein;
+	}
+
+	struct Stream stream;
+	int r = stream_open(dict_path, STREAM_BLOCK_SIZE, &stream);
+	int opened = r == SUGGEST_OK;
+	query_set_deadline(&scan->query, params->deadline_us);
+
+	// Suggestions point into the block (or the carried line), so they are
+	// reported before the block goes back to the reader
+	int first = 1;
+	while (r == SUGGEST_OK) {
+		const char *block;
+		size_t size, tail = 0;
+		if ((r = stream_next(&stream, &block, &size)) != SUGGEST_OK) {
+			break;
+		}
+		if (first && size >= sizeof(IMAGE_MAGIC) - 1 && !memcmp(block, IMAGE_MAGIC, sizeof(IMAGE_MAGIC) - 1)) {
+			r = SUGGEST_ERR_FORMAT;
+			break;
+		}
+		first = 0;
+		if (size) {
+			r = stream_scan_block(scan, block, size, &tail);
+		} else {
+			r = stream_scan_line(scan, scan->carry, scan->carry_length);
+		}
+
+		if (r >= SUGGEST_OK) {
+			for (size_t i = 0; i < scan->results.count; i++) {
+				struct Result *result = &scan->results.items[i];
+				callback(result->word, result->length, result->distance, user_data);
+			}
+		}
+		scan->results.count = 0;
+		if (!size) {
+			break;
+		}
+
+		// A block without a newline goes on with the carried line
+		if (r == SUGGEST_OK && scan->carry_length + size - tail > STREAM_LINE_MAX) {
+			r = SUGGEST_ERR_FORMAT;
+		} else if (r == SUGGEST_OK) {
+			memcpy(scan->carry + scan->carry_length, block + tail, size - tail);
+			scan->carry_length += size - tail;
+		}
+		stream_release(&stream);
+	}
+
+	if (opened) {
+		stream_close(&stream);
+	}
+	free(scan->results.items);
+	free(scan);
+
+	return r;
+}
+
+struct SuggestSession *suggest_session_open (const struct SuggestContext *ctx, const struct SuggestParams *params,
+										   int *error)
+{
+	int r = SUGGEST_OK;
+	struct SuggestSession *session = NULL;
+
+	if (!ctx || !params || params->damerau || params->weighted || params->max_lev_diff < 0
+		|| params->max_lev_diff >= UINT8_MAX) {
+		r = SUGGEST_ERR_ARGUMENT;
+	} else if (ctx->front_coded) {
+		r = SUGGEST_ERR_FORMAT; // rows are kept along the words as they are stored
+	} else if (!(session = calloc(1, sizeof(*session)))) {
+		r = SUGGEST_ERR_NOMEM;
+	} else {
+		session->ctx = ctx;
+		session->params = *params;
+		session->offsets = malloc((ctx->image.header->word_count ? ctx->image.header->word_count : 1)
+								  * sizeof(*session->offsets));
+		session->rows = malloc(ctx->image.header->data_size ? ctx->image.header->data_size : 1);
+		if (!session->offsets || !session->rows) {
+			suggest_session_close(session);
+			session = NULL;
+			r = SUGGEST_ERR_NOMEM;
+		}
+	}
+
+	if (error) {
+		*error = r;
+	}
+	return session;
+}
+
+void suggest_session_close (struct SuggestSession *session)
+{
+	if (session) {
+		free(session->offsets);
+		free(session->rows);
+		free(session);
+	}
+}
+
+void suggest_session_reset (struct SuggestSession *session)
+{
+	session->query_length = 0;
+	session->count = 0;
+}
+
+int suggest_session_append (struct SuggestSession *session, const char *text, size_t length,
+							suggest_callback callback, void *user_data)
+{
+	char codes[UINT8_MAX + 1];
+	if (!session || (!text && length) || !callback
+		|| (text && context_remap(session->ctx, &text, &length, codes) != SUGGEST_OK)
+		|| session->query_length + length > UINT8_MAX) {
+		return SUGGEST_ERR_ARGUMENT;
+	}
+	for (size_t i = 0; i < length; i++) {
+		if (!session->query_length) {
+			session_start(session, text[i]);
+		} else {
+			session_extend(session, text[i]);
+		}
+		session->query_length++;
+	}
+	if (!session->query_length) {
+		return SUGGEST_OK;
+	}
+
+	const char *data = session->ctx->image.data;
+	short max_length_diff = session->params.max_length_diff;
+	const uint8_t *row = session->rows;
+	for (uint64_t i = 0; i < session->count; i++) {
+		uint8_t word_length = (uint8_t)data[session->offsets[i]];
+		size_t length_diff = word_length > session->query_length
+			? word_length - session->query_length : session->query_length - word_length;
+		if (row[word_length] <= session->params.max_lev_diff
+			&& (max_length_diff < 0 || length_diff <= (size_t)max_length_diff)) {
+			size_t spelling_length;
+			const char *spelling = context_spelling(session->ctx, data + session->offsets[i] + sizeof(uint8_t),
+													&spelling_length);
+			callback(spelling, spelling_length, row[word_length], user_data);
+		}
+		row += word_length + 1;
+	}
+
+	return SUGGEST_OK;
+}
+
+const char *suggest_strerror (int error)
+{
+	switch (error) {
+		case SUGGEST_OK:           return "Success";
+		case SUGGEST_PARTIAL:      return "Deadline expired, results are partial";
+		case SUGGEST_ERR_ARGUMENT: return "Invalid argument";
+		case SUGGEST_ERR_IO:       return "Dictionary I/O error";
+		case SUGGEST_ERR_NOMEM:    return "Not enough memory";
+		case SUGGEST_ERR_FORMAT:   return "Malformed dictionary";
+		case SUGGEST_ERR_THREAD:   return "Cannot start worker thread";
+		default:                   return "Unknown error";
+	}
+}
+
+// Results
+
+static int result_append (struct ResultList *results, const char *word, uint8_t length, uint8_t distance)
+{
+	if (results->count == results->capacity) {
+		size_t capacity = results->capacity ? results->capacity * 2 : 64;
+		struct Result *grown = realloc(results->items, capacity * sizeof(*grown));
+		if (!grown) {
+			return SUGGEST_ERR_NOMEM;
+		}
+		results->items = grown;
+		results->capacity = capacity;
+	}
+	results->items[results->count].word = word;
+	results->items[results->count].length = length;
+	results->items[results->count].distance = distance;
+	results->count++;
+	return SUGGEST_OK;
+}
+
+// Dict
+
+static int load_dict (const char *filename, struct SuggestContext *ctx, const struct SuggestOptions *opts)
+{
+	// Images built by dict-build are mapped as is, word lists are built into
+	// the same layout in memory, or in shared memory once for all processes
+	int encoding = opts->alphabet ? alphabet_encoding(opts->alphabet) : ALPHABET_BYTES;
+	int r = image_load(filename, &ctx->image);
+	if (r == IMAGE_NOT_IMAGE && opts->shared_name) {
+		r = image_attach(opts->shared_name, filename, opts->partition_words, encoding, &ctx->image);
+	} else if (r == IMAGE_NOT_IMAGE) {
+		FILE *file = fopen(filename, "r");
+		if (!file) {
+			return SUGGEST_ERR_IO;
+		}
+		struct WordList list;
+		r = word_list_read(file, &list);
+		fclose(file);
+		if (r != SUGGEST_OK) {
+			return r;
+		}
+		r = image_build(&list, opts->partition_words, encoding, IMAGE_CODING_PLAIN, &ctx->image);
+		word_list_free(&list);
+	}
+	if (r != SUGGEST_OK) {
+		return r;
+	}
+
+	ctx->partition_count = ctx->image.header->partition_count;
+
+	uint64_t size;
+	ctx->lengths = image_section(&ctx->image, IMAGE_SECTION_LENGTHS, &size);
+	ctx->offsets = image_section(&ctx->image, IMAGE_SECTION_OFFSETS, &size);
+	ctx->masks = image_section(&ctx->image, IMAGE_SECTION_MASKS, &size);
+	if (ctx->lengths) {
+		ctx->first_words = malloc((ctx->partition_count ? ctx->partition_count : 1) * sizeof(*ctx->first_words));
+		if (!ctx->first_words) {
+			image_free(&ctx->image);
+			return SUGGEST_ERR_NOMEM;
+		}
+		for (uint64_t i = 0, first = 0; i < ctx->partition_count; i++) {
+			ctx->first_words[i] = first;
+			first += ctx->image.partitions[i].word_count;
+		}
+	}
+	ctx->blocks = image_section(&ctx->image, IMAGE_SECTION_BLOCKS, &size);
+	if (ctx->blocks) {
+		ctx->first_blocks = malloc((ctx->partition_count ? ctx->partition_count : 1) * sizeof(*ctx->first_blocks));
+		if (!ctx->first_blocks) {
+			free(ctx->first_words);
+			image_free(&ctx->image);
+			return SUGGEST_ERR_NOMEM;
+		}
+		for (uint64_t i = 0; i < ctx->partition_count; i++) {
+			ctx->first_blocks[i] = ctx->block_count;
+			ctx->block_count += (ctx->image.partitions[i].word_count + IMAGE_BLOCK_WORDS - 1) / IMAGE_BLOCK_WORDS;
+		}
+	}
+	ctx->front_coded = ctx->image.header->coding == IMAGE_CODING_FRONT;
+	ctx->alphabet = image_section(&ctx->image, IMAGE_SECTION_ALPHABET, &size);
+	if (ctx->alphabet) {
+		ctx->spellings = image_section(&ctx->image, IMAGE_SECTION_SPELLINGS, &ctx->spellings_size);
+		r = alphabet_map_init(&ctx->alphabet_map, ctx->alphabet->encoding, &ctx->alphabet->symbols[1],
+							  ctx->alphabet->symbol_count);
+		if (r != SUGGEST_OK) {
+			free(ctx->first_words);
+			free(ctx->first_blocks);
+			image_free(&ctx->image);
+			return r;
+		}
+	}
+	if (opts->costs) {
+		r = load_costs(opts->costs, ctx);
+		if (r != SUGGEST_OK) {
+			unload_dict(ctx);
+			return r;
+		}
+	}
+
+	return SUGGEST_OK;
+}
+
+static void unload_dict (struct SuggestContext *ctx)
+{
+	if (ctx->alphabet) {
+		alphabet_map_free(&ctx->alphabet_map);
+	}
+	free(ctx->costs);
+	free(ctx->first_words);
+	free(ctx->first_blocks);
+	image_free(&ctx->image);
+}
+
+// Query words are remapped once, into codes (UINT8_MAX + 1 bytes), for images
+// of remapped words; SUGGEST_ERR_ARGUMENT when the word has more characters
+// than any word can have
+static int context_remap (const struct SuggestContext *ctx, const char **word, size_t *length, char *codes)
+{
+	if (!ctx->alphabet) {
+		return SUGGEST_OK;
+	}
+	size_t count = alphabet_map(&ctx->alphabet_map, *word, *length, codes);
+	if (count > UINT8_MAX) {
+		return SUGGEST_ERR_ARGUMENT;
+	}
+	codes[count] = 0;
+	*word = codes;
+	*length = count;
+	return SUGGEST_OK;
+}
+
+// Word of the data equal to the text word, NULL if there is none (or ctx has
+// no hash section)
+static const char *context_find (const struct SuggestContext *ctx, const char *word, size_t length)
+{
+	char codes[UINT8_MAX + 1];
+	if (context_remap(ctx, &word, &length, codes) != SUGGEST_OK) {
+		return NULL;
+	}
+	return image_find(&ctx->image, word, length);
+}
+
+// Word of the data as it is reported: its spelling for images of remapped
+// words, itself otherwise
+static const char *context_spelling (const struct SuggestContext *ctx, const char *word, size_t *length)
+{
+	if (!ctx->spellings) {
+		*length = (uint8_t)word[-1];
+		return word;
+	}
+	const char *spelling = (const char *)ctx->spellings + ctx->spellings[context_word_index(ctx, word)];
+	*length = (uint8_t)*spelling;
+	return spelling + sizeof(uint8_t);
+}
+
+// Word of a front-coded image as it is reported: decoded into word (UINT8_MAX
+// + 1 bytes) from the start of its block, the nearest restart point
+static const char *context_decode (const struct SuggestContext *ctx, const char *entry, char *word, size_t *length)
+{
+	// Blocks grow in data order
+	uint64_t offset = entry - ctx->image.data;
+	uint64_t low = 0, high = ctx->block_count;
+	while (high - low > 1) {
+		uint64_t middle = low + (high - low) / 2;
+		if (ctx->blocks[middle].offset <= offset) {
+			low = middle;
+		} else {
+			high = middle;
+		}
+	}
+
+	*length = ctx->blocks[low].max_length;
+	const char *coded = ctx->image.data + ctx->blocks[low].offset;
+	for (;;) {
+		uint8_t shared = *coded;
+		memcpy(word + shared, coded + 1, *length - shared);
+		if (coded == entry) {
+			return word;
+		}
+		coded += 1 + *length - shared;
+	}
+}
+
+// Index of a word of the data, by its offset in the offset column
+static int64_t context_word_index (const struct SuggestContext *ctx, const char *word)
+{
+	const char *data = ctx->image.data;
+	if (word <= data || word > data + ctx->image.header->data_size) {
+		return SUGGEST_ERR_ARGUMENT;
+	}
+
+	// Offsets grow in data order
+	uint64_t offset = word - data - sizeof(uint8_t);
+	uint64_t low = 0, high = ctx->image.header->word_count;
+	while (low < high) {
+		uint64_t middle = low + (high - low) / 2;
+		if (ctx->offsets[middle] < offset) {
+			low = middle + 1;
+		} else {
+			high = middle;
+		}
+	}
+	if (low == ctx->image.header->word_count || ctx->offsets[low] != offset) {
+		return SUGGEST_ERR_ARGUMENT;
+	}
+	return (int64_t)low;
+}
+
+// Cost files are compiled into the substitution table once, over the codes of
+// the alphabet when the dictionary has one (see LevensteinCosts): the table
+// then only has a row and a column per code, and unknown characters (code
+// ALPHABET_UNKNOWN) fall outside it
+static int load_costs (const char *filename, struct SuggestContext *ctx)
+{
+	FILE *file = fopen(filename, "r");
+	if (!file) {
+		return SUGGEST_ERR_IO;
+	}
+	size_t size = ctx->alphabet ? ctx->alphabet->symbol_count + 1 : UCHAR_MAX + 1;
+	struct LevensteinCosts *costs = calloc(1, sizeof(*costs) + size * size);
+	if (!costs) {
+		fclose(file);
+		return SUGGEST_ERR_NOMEM;
+	}
+	costs->size = size;
+
+	// Rules are kept apart until the unit, which every other pair costs, is known
+	unsigned unit = COSTS_DEFAULT_UNIT, min = UCHAR_MAX;
+	uint8_t *ruled = calloc(size * size, sizeof(*ruled));
+	int r = ruled ? SUGGEST_OK : SUGGEST_ERR_NOMEM;
+	int pairs = 0;
+	char line[COSTS_LINE_MAX];
+	while (r == SUGGEST_OK && fgets(line, sizeof(line), file)) {
+		char x[8], y[8], extra;
+		unsigned cost;
+		unsigned char from, to;
+		size_t length = strlen(line);
+		if (line[length - 1] != '\n' && !feof(file)) {
+			r = SUGGEST_ERR_FORMAT;
+		} else if (line[strspn(line, " \t\r\n")] == '\0' || line[strspn(line, " \t")] == '#') {
+			continue;
+		} else if (sscanf(line, "unit %u %c", &unit, &extra) == 1) {
+			if (pairs || !unit || unit > UCHAR_MAX) {
+				r = SUGGEST_ERR_FORMAT;
+			}
+		} else if (sscanf(line, "%7s %7s %u %c", x, y, &cost, &extra) != 3 || cost > UCHAR_MAX) {
+			r = SUGGEST_ERR_FORMAT;
+		} else {
+			pairs++;
+			int known = costs_code(ctx, x, &from);
+			int other = costs_code(ctx, y, &to);
+			if (known < 0 || other < 0) {
+				r = SUGGEST_ERR_FORMAT;
+			} else if (known && other && from != to) {
+				costs->substitution[from * size + to] = costs->substitution[to * size + from] = cost;
+				ruled[from * size + to] = ruled[to * size + from] = 1;
+				min = cost < min ? cost : min;
+			}
+		}
+	}
+	if (r == SUGGEST_OK && ferror(file)) {
+		r = SUGGEST_ERR_IO;
+	}
+	fclose(file);
+
+	if (r == SUGGEST_OK) {
+		for (size_t from = 0; from < size; from++) {
+			for (size_t to = 0; to < size; to++) {
+				if (from != to && !ruled[from * size + to]) {
+					costs->substitution[from * size + to] = unit;
+				}
+			}
+		}
+		costs->unit = unit;
+		costs->min = unit < min ? unit : min;
+		ctx->costs = costs;
+	} else {
+		free(costs);
+	}
+	free(ruled);
+	return r;
+}
+
+// 1 and the code of one character of a cost file, 0 when no word has it, -1
+// when it is not one character
+static int costs_code (const struct SuggestContext *ctx, const char *character, unsigned char *code)
+{
+	if (!ctx->alphabet) {
+		*code = (unsigned char)character[0];
+		return strlen(character) == 1 ? 1 : -1;
+	}
+	char codes[UINT8_MAX + 1];
+	if (alphabet_map(&ctx->alphabet_map, character, strlen(character), codes) != 1) {
+		return -1;
+	}
+	*code = (unsigned char)codes[0];
+	return *code != ALPHABET_UNKNOWN;
+}
+
+// Query
+
+struct ScheduleEntry {
+	uint64_t partition;
+	uint16_t tier;
+	uint8_t length_diff;
+};
+
+// Most frequent tiers first, nearest lengths first within a tier
+static int schedule_compare (const void *a, const void *b)
+{
+	const struct ScheduleEntry *left = a, *right = b;
+	if (left->tier != right->tier) {
+		return (int)left->tier - (int)right->tier;
+	}
+	if (left->length_diff != right->length_diff) {
+		return (int)left->length_diff - (int)right->length_diff;
+	}
+	return left->partition < right->partition ? -1 : left->partition > right->partition;
+}
+
+static int print_closest (const struct SuggestContext *ctx, const char *word, const struct SuggestParams *params,
+						  struct Query *query)
+{
+	int r = print_closest_schedule(ctx, word, params, query);
+	return r == SUGGEST_OK ? print_closest_fork(query, 1) : r;
+}
+
+// Everything but the scan: the schedule, the engine and the deadline, which
+// only starts once the query is ready to scan
+static int print_closest_schedule (const struct SuggestContext *ctx, const char *word,
+								   const struct SuggestParams *params, struct Query *query)
+{
+	PROBE_QUERY_START(word, strlen(word), params->max_length_diff, params->max_lev_diff);
+	int r = query_schedule(ctx, word, params, query);
+	if (r == SUGGEST_OK) {
+		r = engine_select(query);
+	}
+	if (r != SUGGEST_OK) {
+		return r;
+	}
+	PROBE_QUERY_ENGINE(word, query->engine->name);
+	query_set_deadline(query, params->deadline_us);
+	return SUGGEST_OK;
+}
+
+// The partitions within max_length_diff in scan order, most promising first
+static int query_schedule (const struct SuggestContext *ctx, const char *word, const struct SuggestParams *params,
+						   struct Query *query)
+{
+	memset(query, 0, sizeof(*query));
+	query->ctx = ctx;
+	query->word = word;
+	query->word_len = strlen(word);
+	query->params = params;
+	query->mask = image_word_mask(word, query->word_len);
+	query->max_edits = query->max_indels = params->max_lev_diff;
+	if (params->weighted) {
+		query->costs = ctx->costs;
+		query->max_edits = ctx->costs->min ? params->max_lev_diff / ctx->costs->min : SHRT_MAX;
+		query->max_indels = params->max_lev_diff / ctx->costs->unit;
+	}
+
+	// Partitions whose length is out of max_length_diff are not scanned at all
+	struct ScheduleEntry *entries = malloc((ctx->partition_count ? ctx->partition_count : 1) * sizeof(*entries));
+	if (!entries) {
+		return SUGGEST_ERR_NOMEM;
+	}
+	for (uint64_t i = 0; i < ctx->partition_count; i++) {
+		const struct ImagePartition *partition = &ctx->image.partitions[i];
+		size_t length_diff = partition->length > query->word_len
+			? partition->length - query->word_len : query->word_len - partition->length;
+		if (params->max_length_diff >= 0 && length_diff > (size_t)params->max_length_diff) {
+			continue;
+		}
+		entries[query->scheduled].partition = i;
+		entries[query->scheduled].tier = partition->tier;
+		entries[query->scheduled].length_diff = length_diff > UINT8_MAX ? UINT8_MAX : length_diff;
+		query->scheduled++;
+		query->scheduled_words += partition->word_count;
+	}
+	qsort(entries, query->scheduled, sizeof(*entries), schedule_compare);
+
+	query->schedule = malloc((query->scheduled ? query->scheduled : 1) * sizeof(*query->schedule));
+	query->results = calloc(query->scheduled ? query->scheduled : 1, sizeof(*query->results));
+	if (!query->schedule || !query->results) {
+		free(entries);
+		query->scheduled = 0;
+		return SUGGEST_ERR_NOMEM;
+	}
+	for (uint64_t i = 0; i < query->scheduled; i++) {
+		query->schedule[i] = entries[i].partition;
+	}
+	free(entries);
+	return SUGGEST_OK;
+}
+
+// Scans the schedules of count queries with the same params in one pass
+static int print_closest_fork (struct Query *queries, size_t count)
+{
+	struct Pass pass = { queries, NULL, 0, 0 };
+	for (size_t q = 0; q < count; q++) {
+		pass.scheduled += queries[q].scheduled;
+	}
+	uint64_t workers_count = queries->params->threads < pass.scheduled ? queries->params->threads : pass.scheduled;
+	if (!workers_count) {
+		return SUGGEST_OK;
+	}
+
+	// Slots of every query, interleaved so that the most promising partitions of
+	// all of them come first (a single schedule is in that order already)
+	pass.slots = malloc(pass.scheduled * sizeof(*pass.slots));
+	if (!pass.slots) {
+		return SUGGEST_ERR_NOMEM;
+	}
+	struct PassSlot *slot = pass.slots;
+	for (size_t q = 0; q < count; q++) {
+		for (uint64_t i = 0; i < queries[q].scheduled; i++, slot++) {
+			const struct ImagePartition *partition = &queries[q].ctx->image.partitions[queries[q].schedule[i]];
+			size_t length_diff = partition->length > queries[q].word_len
+				? partition->length - queries[q].word_len : queries[q].word_len - partition->length;
+			slot->tier = partition->tier;
+			slot->length_diff = length_diff > UINT8_MAX ? UINT8_MAX : length_diff;
+			slot->query = q;
+			slot->slot = i;
+		}
+	}
+	if (count > 1) {
+		qsort(pass.slots, pass.scheduled, sizeof(*pass.slots), pass_slot_compare);
+	}
+
+	struct Worker workers[workers_count];
+	for (uint64_t i = 0; i < workers_count; i++) {
+		workers[i].pass = &pass;
+		workers[i].query = queries;
+		workers[i].error = SUGGEST_OK;
+		workers[i].index = i;
+	}
+
+	// The calling thread is a worker too
+	uint64_t started = 1;
+	int r = SUGGEST_OK;
+	for (; started < workers_count; started++) {
+		if (pthread_create(&workers[started].thread, NULL, print_closest_worker, &workers[started])) {
+			r = SUGGEST_ERR_THREAD;
+			break;
+		}
+	}
+
+	print_closest_worker(&workers[0]);
+
+	for (uint64_t i = 1; i < started; i++) {
+		pthread_join(workers[i].thread, NULL);
+	}
+	for (uint64_t i = 0; i < started && r == SUGGEST_OK; i++) {
+		r = workers[i].error;
+	}
+
+	free(pass.slots);
+	return r;
+}
+
+// Like schedule_compare(), earlier queries first among equals
+static int pass_slot_compare (const void *a, const void *b)
+{
+	const struct PassSlot *left = a, *right = b;
+	if (left->tier != right->tier) {
+		return (int)left->tier - (int)right->tier;
+	}
+	if (left->length_diff != right->length_diff) {
+		return (int)left->length_diff - (int)right->length_diff;
+	}
+	if (left->query != right->query) {
+		return left->query < right->query ? -1 : 1;
+	}
+	return left->slot < right->slot ? -1 : left->slot > right->slot;
+}
+
+static void *print_closest_worker (void *arg)
+{
+	struct Worker *worker = arg;
+	struct Pass *pass = worker->pass;
+
+	PROBE_WORKER_START(worker->index);
+	uint64_t partitions = 0;
+	while (worker->error == SUGGEST_OK && !query_expired(worker->query)) {
+		uint64_t next = __atomic_fetch_add(&pass->next, 1, __ATOMIC_RELAXED);
+		if (next >= pass->scheduled) {
+			break;
+		}
+		struct Query *query = worker->query = &pass->queries[pass->slots[next].query];
+		uint64_t slot = pass->slots[next].slot;
+		uint64_t partition = query->schedule[slot];
+		worker->error = query->engine->scan(worker, &query->results[slot], partition);
+		partitions++;
+		PROBE_PARTITION_DONE(worker->index, partition, query->ctx->image.partitions[partition].word_count,
+							 query->results[slot].count);
+	}
+
+	PROBE_WORKER_END(worker->index, partitions, worker->error);
+	return NULL;
+}
+
+static int print_closest_partition (struct Worker *worker, struct ResultList *results, uint64_t partition)
+{
+	struct Query *query = worker->query;
+	const struct SuggestContext *ctx = query->ctx;
+	if (!ctx->blocks) {
+		return print_closest_iterations(worker, results, image_partition(&ctx->image, partition), SIZE_MAX);
+	}
+
+	// Words are read block by block, skipping the blocks ruled out as a whole
+	const struct ImageBlock *block = ctx->blocks + ctx->first_blocks[partition];
+	uint64_t count = (ctx->image.partitions[partition].word_count + IMAGE_BLOCK_WORDS - 1) / IMAGE_BLOCK_WORDS;
+	int r = SUGGEST_OK;
+	for (uint64_t i = 0; i < count && r == SUGGEST_OK; i++, block++) {
+		if (query->has_deadline && i && !(i * IMAGE_BLOCK_WORDS % DEADLINE_CHECK_WORDS) && query_expired(query)) {
+			break;
+		}
+		if (query_skips_block(query, block)) {
+			continue;
+		}
+		if (ctx->front_coded) {
+			r = print_closest_decoded(worker, results, block);
+		} else {
+			r = print_closest_iterations(worker, results, ctx->image.data + block->offset, block->word_count);
+		}
+	}
+
+	return r;
+}
+
+// At most limit words are read, up to the end of the partition
+static int print_closest_iterations (struct Worker *worker, struct ResultList *results, const char *offset,
+									 size_t limit)
+{
+	struct Query *query = worker->query;
+
+	int r = SUGGEST_OK;
+	size_t local_offset = 0;
+	size_t sizeof_uint8_t = sizeof(uint8_t);
+	size_t words = 0;
+	while (words++ < limit && *(offset + local_offset) != 0 && r == SUGGEST_OK) {
+		if (query->has_deadline && !(words % DEADLINE_CHECK_WORDS) && query_expired(query)) {
+			break;
+		}
+
+		uint8_t local_word_length = *(offset + local_offset);
+		const char *local_word = offset + local_offset + sizeof_uint8_t;
+		r = print_closest_segment(results, query, local_word, local_word_length);
+
+		local_offset += sizeof_uint8_t + local_word_length;
+	}
+
+	return r;
+}
+
+// Words of a front-coded block are decoded one after the other into the same
+// buffer, each over the bytes it shares with the previous one
+static int print_closest_decoded (struct Worker *worker, struct ResultList *results, const struct ImageBlock *block)
+{
+	struct Query *query = worker->query;
+	const struct SuggestContext *ctx = query->ctx;
+	short max_lev_diff = query->params->max_lev_diff;
+	const char *end = ctx->image.data + ctx->image.header->data_size;
+	const char *coded = ctx->image.data + block->offset;
+	uint8_t length = block->max_length;
+	char word[UINT8_MAX + 8];
+
+	int r = SUGGEST_OK;
+	for (unsigned i = 0; i < block->word_count && r == SUGGEST_OK; i++) {
+		uint8_t shared = *coded;
+		if (shared > (i ? length : 0) || coded + 1 + length - shared > end) {
+			return SUGGEST_ERR_FORMAT;
+		}
+		// Eight bytes at a time while that stays within the data
+		const char *suffix = coded + 1 - shared;
+		unsigned j = shared;
+		if (coded + 1 + length - shared + 8 <= end) {
+			for (; j < length; j += 8) {
+				memcpy(word + j, suffix + j, 8);
+			}
+		}
+		for (; j < length; j++) {
+			word[j] = suffix[j];
+		}
+		size_t result = segment_distance(query, word, length);
+		if (result <= (size_t)max_lev_diff) {
+			r = result_append(results, coded, length, (uint8_t)result);
+		}
+		coded += 1 + length - shared;
+	}
+
+	return r;
+}
+
+// Only the words passing the prefilter over the mask column are read
+static int print_closest_columns (struct Worker *worker, struct ResultList *results, uint64_t partition)
+{
+	struct Query *query = worker->query;
+	const struct SuggestContext *ctx = query->ctx;
+	uint64_t first = ctx->first_words[partition];
+	uint64_t count = ctx->image.partitions[partition].word_count;
+
+	int r = SUGGEST_OK;
+	for (uint64_t chunk = 0; chunk < count && r == SUGGEST_OK; chunk += 64) {
+		if (query->has_deadline && !(chunk % DEADLINE_CHECK_WORDS) && chunk && query_expired(query)) {
+			break;
+		}
+
+		// Chunks are blocks (IMAGE_BLOCK_WORDS is 64)
+		if (ctx->blocks && query_skips_block(query, &ctx->blocks[ctx->first_blocks[partition] + chunk / 64])) {
+			continue;
+		}
+
+		size_t chunk_words = count - chunk < 64 ? count - chunk : 64;
+		uint64_t candidates = columns_prefilter(ctx->masks + first + chunk, chunk_words, query->mask,
+													 query->max_edits);
+		while (candidates && r == SUGGEST_OK) {
+			uint64_t i = first + chunk + __builtin_ctzll(candidates);
+			candidates &= candidates - 1;
+			r = print_closest_segment(results, query, ctx->image.data + ctx->offsets[i] + sizeof(uint8_t),
+									  ctx->lengths[i]);
+		}
+	}
+
+	return r;
+}
+
+// True when no word of the block can be within max_lev_diff: the length
+// difference and the characters missing from either side bound the number of
+// edits to every word of the block from below (see columns_prefilter())
+static int query_skips_block (const struct Query *query, const struct ImageBlock *block)
+{
+	short max_length_diff = query->params->max_length_diff;
+	short length_diff = max_length_diff >= 0 && max_length_diff < query->max_indels
+		? max_length_diff : query->max_indels;
+	if (block->min_length > query->word_len + length_diff
+		|| (size_t)(block->max_length + length_diff) < query->word_len) {
+		return 1;
+	}
+	int missing = __builtin_popcountll(query->mask & ~block->any);
+	int extra = __builtin_popcountll(block->all & ~query->mask);
+	return (missing > extra ? missing : extra) > query->max_edits;
+}
+
+#ifdef __SSE2__
+// Bits set in each 64-bit lane
+static inline __m128i columns_popcount (__m128i x)
+{
+	const __m128i m1 = _mm_set1_epi8(0x55), m2 = _mm_set1_epi8(0x33), m4 = _mm_set1_epi8(0x0f);
+	x = _mm_sub_epi8(x, _mm_and_si128(_mm_srli_epi64(x, 1), m1));
+	x = _mm_add_epi8(_mm_and_si128(x, m2), _mm_and_si128(_mm_srli_epi64(x, 2), m2));
+	x = _mm_and_si128(_mm_add_epi8(x, _mm_srli_epi64(x, 4)), m4);
+	return _mm_sad_epu8(x, _mm_setzero_si128());
+}
+#endif
+
+// Bit i is set when masks[i] does not rule its word out: the characters missing
+// from either side need at least that many edits (see image_word_mask())
+static uint64_t columns_prefilter (const uint64_t *masks, size_t count, uint64_t mask, short max_lev_diff)
+{
+	uint64_t candidates = 0;
+	size_t i = 0;
+#ifdef __SSE2__
+	const __m128i query = _mm_set1_epi64x(mask);
+	const __m128i limit = _mm_set1_epi32(max_lev_diff + 1);
+	for (; i + 2 <= count; i += 2) {
+		__m128i words = _mm_loadu_si128((const __m128i *)(masks + i));
+		__m128i missing = columns_popcount(_mm_andnot_si128(words, query));
+		__m128i extra = columns_popcount(_mm_andnot_si128(query, words));
+		__m128i bound = _mm_max_epi16(missing, extra);
+		// Counts are in the low 32 bits of each lane, so lanes are taken from mask bits 0 and 2
+		int pass = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmplt_epi32(bound, limit)));
+		candidates |= (uint64_t)((pass & 1) | ((pass >> 1) & 2)) << i;
+	}
+#endif
+	for (; i < count; i++) {
+		int missing = __builtin_popcountll(mask & ~masks[i]);
+		int extra = __builtin_popcountll(masks[i] & ~mask);
+		if ((missing > extra ? missing : extra) <= max_lev_diff) {
+			candidates |= (uint64_t)1 << i;
+		}
+	}
+	return candidates;
+}
+
+static int print_closest_segment (struct ResultList *results, const struct Query *query, const char *local_word,
+								  uint8_t local_word_length)
+{
+	size_t result = segment_distance(query, local_word, local_word_length);
+	if (result <= (size_t)query->params->max_lev_diff) {
+		return result_append(results, local_word, local_word_length, (uint8_t)result);
+	}
+	return SUGGEST_OK;
+}
+
+// SIZE_MAX when the lengths are too far apart
+static size_t segment_distance (const struct Query *query, const char *local_word, uint8_t local_word_length)
+{
+	const char *word = query->word;
+	size_t word_len = query->word_len;
+	short max_length_diff = query->params->max_length_diff;
+	size_t result = -1;
+
+	if (word_len == local_word_length && !strncmp(local_word, word, local_word_length)) {
+		result = 0;
+		
+	} else {
+		
+		if (abs(word_len - local_word_length) <= max_length_diff) {
+			result = query->costs
+				? levenstein_weighted(query->costs, query->params->max_lev_diff, word, word_len, local_word,
+									  local_word_length)
+				: query->kernel(word, word_len, local_word, local_word_length);
+		}
+	}
+
+	return result;
+}
+
+// Distances are reported in a byte, and the shard protocol keeps UINT8_MAX
+// for its end record: queries of at most UINT8_MAX bytes (or characters of
+// the alphabet), within fewer than UINT8_MAX edits
+static int query_usable (const struct SuggestParams *params, size_t length)
+{
+	return params->max_lev_diff < UINT8_MAX && length <= UINT8_MAX;
+}
+
+// Weighted queries need a cost file, and the weighted kernel distances of at
+// most UINT8_MAX between words of at most UINT8_MAX bytes
+static int query_weighted_usable (const struct SuggestContext *ctx, const struct SuggestParams *params, size_t length)
+{
+	return ctx->costs && !params->damerau && params->max_lev_diff >= 0 && params->max_lev_diff < UINT8_MAX
+		&& length <= UINT8_MAX;
+}
+
+static void query_set_deadline (struct Query *query, long deadline_us)
+{
+	if (deadline_us) {
+		clock_gettime(CLOCK_MONOTONIC, &query->deadline);
+		query->deadline.tv_sec += deadline_us / 1000000;
+		query->deadline.tv_nsec += (deadline_us % 1000000) * 1000;
+		if (query->deadline.tv_nsec >= 1000000000) {
+			query->deadline.tv_sec++;
+			query->deadline.tv_nsec -= 1000000000;
+		}
+		query->has_deadline = 1;
+	}
+}
+
+// Once expired stays expired, so workers only look at the clock until then
+static int query_expired (struct Query *query)
+{
+	if (!query->has_deadline) {
+		return 0;
+	}
+	if (__atomic_load_n(&query->expired, __ATOMIC_RELAXED)) {
+		return 1;
+	}
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (now.tv_sec > query->deadline.tv_sec
+		|| (now.tv_sec == query->deadline.tv_sec && now.tv_nsec >= query->deadline.tv_nsec)) {
+		__atomic_store_n(&query->expired, 1, __ATOMIC_RELAXED);
+		return 1;
+	}
+	return 0;
+}
+
+// Engines
+
+// The named engine, or the one suggest_calibrate() found fastest for this
+// distance and max_lev_diff on this dictionary, or the first usable one
+static int engine_select (struct Query *query)
+{
+	const struct SuggestContext *ctx = query->ctx;
+	const struct SuggestParams *params = query->params;
+
+	if (params->engine && strcmp(params->engine, "auto")) {
+		for (size_t i = 0; i < ENGINE_COUNT; i++) {
+			if (!strcmp(params->engine, engines[i].name) && engines[i].usable(ctx, params)) {
+				engine_use(query, &engines[i]);
+				return SUGGEST_OK;
+			}
+		}
+		return SUGGEST_ERR_ARGUMENT;
+	}
+
+	int calibrated = ctx->engines[engine_choice(params)];
+	if (calibrated) {
+		engine_use(query, &engines[calibrated - 1]);
+		return SUGGEST_OK;
+	}
+	for (size_t i = 0; i < ENGINE_COUNT; i++) {
+		if (engines[i].usable(ctx, params)) {
+			engine_use(query, &engines[i]);
+			return SUGGEST_OK;
+		}
+	}
+	return SUGGEST_ERR_ARGUMENT;
+}
+
+// Entry of ctx->engines for the distance and the max_lev_diff of params
+static size_t engine_choice (const struct SuggestParams *params)
+{
+	size_t kernel = params->weighted ? 2 : params->damerau ? 1 : 0;
+	size_t choice = params->max_lev_diff < 0 ? 0
+		: params->max_lev_diff > LEVENSTEIN_MAX_BOUNDED ? ENGINE_CHOICES - 1 : (size_t)params->max_lev_diff;
+	return kernel * ENGINE_CHOICES + choice;
+}
+
+// Times the engine over the first ENGINE_CALIBRATION_WORDS words of the schedule
+static int engine_calibrate (struct Query *query, const struct Engine *engine, double *seconds)
+{
+	engine_use(query, engine);
+	struct Worker worker = { .query = query, .error = SUGGEST_OK };
+
+	struct ResultList results = { NULL, 0, 0 };
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	uint64_t words = 0;
+	for (uint64_t slot = 0; slot < query->scheduled && words < ENGINE_CALIBRATION_WORDS
+			 && worker.error == SUGGEST_OK; slot++) {
+		worker.error = engine->scan(&worker, &results, query->schedule[slot]);
+		words += query->ctx->image.partitions[query->schedule[slot]].word_count;
+		results.count = 0;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	*seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+	free(results.items);
+	return worker.error;
+}
+
+static void engine_use (struct Query *query, const struct Engine *engine)
+{
+	query->engine = engine;
+	if (query->params->damerau) {
+		query->kernel = levenstein_osa;
+	} else {
+		query->kernel = engine->bounded ? levenstein_select(query->params->max_lev_diff) : NULL;
+	}
+	if (!query->kernel) {
+		query->kernel = levenstein; // the full DP, beyond the bounded kernels
+	}
+}
+
+static int engine_columnar_usable (const struct SuggestContext *ctx, const struct SuggestParams *params)
+{
+	(void)params;
+	return ctx->lengths != NULL;
+}
+
+static int engine_bounded_usable (const struct SuggestContext *ctx, const struct SuggestParams *params)
+{
+	(void)ctx;
+	return levenstein_select(params->max_lev_diff) != NULL;
+}
+
+static int engine_classic_usable (const struct SuggestContext *ctx, const struct SuggestParams *params)
+{
+	(void)ctx;
+	(void)params;
+	return 1;
+}
+
+// Streaming
+
+// Scans the lines of a block, the first one completing the carried line.
+// *tail is where the last line, cut by the end of the block, starts.
+static int stream_scan_block (struct StreamScan *scan, const char *block, size_t size, size_t *tail)
+{
+	int r = SUGGEST_OK;
+	size_t start = 0;
+	const char *end;
+	while (r == SUGGEST_OK && (end = memchr(block + start, '\n', size - start))) {
+		size_t length = end - (block + start);
+		if (scan->carry_length) {
+			if (scan->carry_length + length > STREAM_LINE_MAX) {
+				return SUGGEST_ERR_FORMAT;
+			}
+			memcpy(scan->carry + scan->carry_length, block + start, length);
+			r = stream_scan_line(scan, scan->carry, scan->carry_length + length);
+			scan->carry_length = 0;
+		} else {
+			r = stream_scan_line(scan, block + start, length);
+		}
+		start += length + 1;
+	}
+
+	*tail = start;
+	return r;
+}
+
+static int stream_scan_line (struct StreamScan *scan, const char *line, size_t length)
+{
+	struct Query *query = &scan->query;
+	if (query->has_deadline && !(++scan->words % DEADLINE_CHECK_WORDS) && query_expired(query)) {
+		return SUGGEST_PARTIAL;
+	}
+
+	uint64_t frequency;
+	length = word_list_line(line, length, &frequency);
+	if (!length) {
+		return SUGGEST_OK;
+	}
+	if (length > UINT8_MAX) {
+		return SUGGEST_ERR_FORMAT;
+	}
+	return print_closest_segment(&scan->results, query, line, (uint8_t)length);
+}
+
+// Sessions
+
+// First character: every word of the dictionary gets its first row
+static void session_start (struct SuggestSession *session, char c)
+{
+	const struct SuggestContext *ctx = session->ctx;
+	uint8_t limit = session->params.max_lev_diff + 1;
+	uint8_t *row = session->rows;
+	session->count = 0;
+
+	for (uint64_t i = 0; i < ctx->partition_count; i++) {
+		const char *offset = image_partition(&ctx->image, i);
+		while (*offset) {
+			uint8_t length = (uint8_t)*offset;
+			for (size_t j = 0; j <= length; j++) {
+				row[j] = j < limit ? j : limit;
+			}
+			if (session_row(row, offset + sizeof(uint8_t), length, c, 1, limit)) {
+				session->offsets[session->count++] = offset - ctx->image.data;
+				row += length + 1;
+			}
+			offset += sizeof(uint8_t) + length;
+		}
+	}
+}
+
+// Next characters: the candidates left get one more row, those that cannot
+// come back within max_lev_diff are dropped
+static void session_extend (struct SuggestSession *session, char c)
+{
+	const char *data = session->ctx->image.data;
+	uint8_t limit = session->params.max_lev_diff + 1;
+	uint8_t *row = session->rows, *kept = session->rows;
+	uint64_t count = 0;
+
+	for (uint64_t i = 0; i < session->count; i++) {
+		uint8_t length = (uint8_t)data[session->offsets[i]];
+		if (session_row(row, data + session->offsets[i] + sizeof(uint8_t), length, c,
+						session->query_length + 1, limit)) {
+			memmove(kept, row, length + 1);
+			kept += length + 1;
+			session->offsets[count++] = session->offsets[i];
+		}
+		row += length + 1;
+	}
+	session->count = count;
+}
+
+/* Turns the row of the query without c into the row of the query with c
+ * (query_length counts c) in place. Returns whether some prefix of the word
+ * is still within limit - 1: rows never decrease from one character to the
+ * next, so once none is the word is out for good.
+ */
+static int session_row (uint8_t *row, const char *word, uint8_t length, char c, size_t query_length, uint8_t limit)
+{
+	uint8_t diagonal = row[0];
+	row[0] = query_length < limit ? query_length : limit;
+	uint8_t min = row[0];
+	for (size_t j = 1; j <= length; j++) {
+		uint8_t up = row[j];
+		int cell = diagonal + (word[j - 1] != c); // up to limit + 1, which may not fit a cell
+		if (up + 1 < cell) {
+			cell = up + 1;
+		}
+		if (row[j - 1] + 1 < cell) {
+			cell = row[j - 1] + 1;
+		}
+		diagonal = up;
+		row[j] = cell < limit ? cell : limit;
+		if (row[j] < min) {
+			min = row[j];
+		}
+	}
+	return min < limit;
+}
+
+// Completion
+
+/* Walks the sorted words as an implicit trie. Row d holds the edit distances
+ * between every prefix of the query and the first d bytes of the current
+ * word; rows shared with the previous word are kept, so each distinct
+ * dictionary prefix is computed once. best[d] is the smallest distance of the
+ * whole query to any of those first d bytes. Once a row has no cell within
+ * the threshold no longer word can do better, so all words sharing that
+ * prefix are settled at once.
+ */
+static int print_completions (struct Completer *completer, struct ResultList *results)
+{
+	size_t m = completer->prefix_len;
+	uint16_t *rows = completer->rows;
+
+	for (size_t j = 0; j <= m; j++) {
+		rows[j] = j;
+	}
+	completer->best[0] = m;
+
+	const char *previous = NULL;
+	size_t computed = 0; // rows valid for the previous word
+	size_t i = 0;
+	while (i < completer->word_count) {
+		// A word listed twice is offered once
+		if (completion_repeats(completer, i)) {
+			i++;
+			continue;
+		}
+		const char *entry = completer->data + completer->sorted[i];
+		uint8_t length = *entry;
+		const char *word = entry + 1;
+
+		size_t depth = 0;
+		while (depth < computed && depth < length && previous[depth] == word[depth]) {
+			depth++;
+		}
+
+		// Once limit words are kept, only those that can beat the worst one matter
+		short k = completion_bound(completer, results);
+		int pruned = 0;
+		while (depth < length) {
+			const uint16_t *row = rows + depth * (m + 1);
+			uint16_t *next = rows + (depth + 1) * (m + 1);
+			uint16_t row_min = next[0] = row[0] + 1;
+			for (size_t j = 1; j <= m; j++) {
+				uint16_t v = row[j - 1] + (completer->prefix[j - 1] != word[depth]);
+				if (v > row[j] + 1) v = row[j] + 1;
+				if (v > next[j - 1] + 1) v = next[j - 1] + 1;
+				next[j] = v;
+				if (row_min > v) row_min = v;
+			}
+			depth++;
+			completer->best[depth] = completer->best[depth - 1] < next[m] ? completer->best[depth - 1] : next[m];
+			if (row_min > k) {
+				pruned = 1;
+				break;
+			}
+		}
+		computed = depth;
+		previous = word;
+
+		if (!pruned) {
+			if (completer->best[length] <= k) {
+				int r = completion_offer(completer, results, word, length, completer->best[length]);
+				if (r != SUGGEST_OK) return r;
+			}
+			i++;
+			continue;
+		}
+
+		// Every word starting with word[0 .. depth) ends with the same best
+		size_t end = completion_skip(completer, i + 1, word, depth);
+		for (; i < end && completer->best[depth] <= completion_bound(completer, results); i++) {
+			if (completion_repeats(completer, i)) {
+				continue;
+			}
+			entry = completer->data + completer->sorted[i];
+			int r = completion_offer(completer, results, entry + 1, (uint8_t)*entry, completer->best[depth]);
+			if (r != SUGGEST_OK) return r;
+		}
+		i = end;
+	}
+
+	return SUGGEST_OK;
+}
+
+// First index from `from` on whose word does not start with word[0 .. depth)
+static size_t completion_skip (const struct Completer *completer, size_t from, const char *word, size_t depth)
+{
+	size_t low = from, high = completer->word_count;
+	while (low < high) {
+		size_t middle = low + (high - low) / 2;
+		const char *entry = completer->data + completer->sorted[middle];
+		if ((uint8_t)*entry >= depth && !memcmp(entry + 1, word, depth)) {
+			low = middle + 1;
+		} else {
+			high = middle;
+		}
+	}
+	return low;
+}
+
+// Whether the word at i is the same as the one before it; the sorted index
+// of a word list keeps one entry per copy
+static int completion_repeats (const struct Completer *completer, size_t i)
+{
+	if (i == 0) {
+		return 0;
+	}
+	const char *entry = completer->data + completer->sorted[i];
+	const char *before = completer->data + completer->sorted[i - 1];
+	return !memcmp(entry, before, (uint8_t)*entry + 1);
+}
+
+// Results are a heap of at most limit words, the worst one (see
+// completion_compare()) on top
+static int completion_offer (const struct Completer *completer, struct ResultList *results, const char *word,
+							 uint8_t length, uint8_t distance)
+{
+	struct Result offered = { word, length, distance };
+	size_t i;
+	if (results->count < completer->limit) {
+		int r = result_append(results, word, length, distance);
+		if (r != SUGGEST_OK) {
+			return r;
+		}
+		struct Result *heap = results->items;
+		for (i = results->count - 1; i && completion_compare(&heap[(i - 1) / 2], &offered) < 0; i = (i - 1) / 2) {
+			heap[i] = heap[(i - 1) / 2];
+		}
+		heap[i] = offered;
+		return SUGGEST_OK;
+	}
+
+	struct Result *heap = results->items;
+	if (completion_compare(&offered, &heap[0]) >= 0) {
+		return SUGGEST_OK;
+	}
+	for (i = 0; 2 * i + 1 < results->count;) {
+		size_t child = 2 * i + 1;
+		if (child + 1 < results->count && completion_compare(&heap[child + 1], &heap[child]) > 0) {
+			child++;
+		}
+		if (completion_compare(&heap[child], &offered) <= 0) {
+			break;
+		}
+		heap[i] = heap[child];
+		i = child;
+	}
+	heap[i] = offered;
+	return SUGGEST_OK;
+}
+
+// Largest distance still worth finding: max_lev_diff, or that of the worst
+// kept word once there are limit of them (a word at the same distance may
+// still beat it)
+static short completion_bound (const struct Completer *completer, const struct ResultList *results)
+{
+	if (results->count < completer->limit || results->items[0].distance > completer->max_lev_diff) {
+		return completer->max_lev_diff;
+	}
+	return results->items[0].distance;
+}
+
+static int completion_compare (const void *a, const void *b)
+{
+	const struct Result *left = a, *right = b;
+	if (left->distance != right->distance) {
+		return (int)left->distance - (int)right->distance;
+	}
+	if (left->length != right->length) {
+		return (int)left->length - (int)right->length;
+	}
+	return memcmp(left->word, right->word, left->length);
+}
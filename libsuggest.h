@@ -0,0 +1,258 @@
+/** 
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2013, Valera Leontyev.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *  - this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *  - this list of conditions and the following disclaimer in the documentation
+ *  - and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of the Valera Leontyev nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef LIBSUGGEST_H_INCLUDED
+#define LIBSUGGEST_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* libsuggest: "Did you mean XXX?" engine as a library.
+ *
+ * A context holds a loaded dictionary and is read-only after suggest_open()
+ * (and the suggest_calibrate() calls that follow it, if any), so any number
+ * of threads may run suggest_query() on it concurrently.
+ * Functions never exit or print: failures are reported as SUGGEST_ERR_* codes.
+ */
+
+// Error codes
+#define SUGGEST_OK            0
+#define SUGGEST_PARTIAL       1 // the deadline expired, only part of the dictionary was searched
+#define SUGGEST_ERR_ARGUMENT -1
+#define SUGGEST_ERR_IO       -2
+#define SUGGEST_ERR_NOMEM    -3
+#define SUGGEST_ERR_FORMAT   -4
+#define SUGGEST_ERR_THREAD   -5
+
+struct SuggestContext;
+
+// Dictionary load options
+struct SuggestOptions {
+	uint32_t partition_words; // word lists are cut into partitions of this many words, images keep their own
+	const char *shared_name;  // word lists are built once per host into this shared memory object (see
+	                          // shm_open()) and mapped read-only by every later open, NULL to build privately
+	const char *alphabet;     // word lists are case folded and remapped to their alphabet in this encoding
+	                          // ("latin1", "cp1251" or "utf8", see alphabet.h), NULL to keep the bytes;
+	                          // images keep the alphabet dict-build gave them
+	const char *costs;        // edit cost file compiled into the context for weighted queries, NULL for none
+};
+
+// Query parameters
+struct SuggestParams {
+	short max_length_diff;
+	short max_lev_diff;
+	uint8_t threads; // worker threads scanning the partitions, 1 scans in the calling thread
+	long deadline_us; // stop scanning this long after the scan started, 0 for no deadline
+	const char *engine; // "columnar", "bounded", "classic", or NULL (or "auto") to pick the fastest one
+	uint8_t exact_first; // a word found in the dictionary is reported alone, at distance 0, without searching
+	uint8_t damerau; // swapping two adjacent characters is one edit (see levenstein_osa()), not two
+	uint8_t weighted; // edits cost what the cost file of the context says, max_lev_diff is in its units
+};
+
+/* Cost files: one rule per line, blank lines and lines starting with # are
+ * skipped. "unit N" (first, 2 by default) is the cost of an insertion, a
+ * deletion and every substitution without a rule, from 1 to 255; "x y N"
+ * makes substituting the character x for y and y for x cost N, from 0 to
+ * 255, e.g. 1 for keys next to each other or 0 for look-alike letters of two
+ * scripts. Characters are bytes, or characters of the alphabet of the
+ * dictionary (case folded the same way) when it has one; rules about
+ * characters that no word has are ignored.
+ * The rules are compiled into a table of one cost per pair of characters of
+ * the alphabet (of all 256 bytes without one) when the context is opened.
+ * A weighted query reports the cost of the cheapest edits, within
+ * max_lev_diff (below UINT8_MAX) units. It is compared with a bounded kernel
+ * that only scans the band of insertions and deletions max_lev_diff affords,
+ * and every engine skips blocks and words with the bounds scaled to the
+ * cheapest edit. SUGGEST_ERR_ARGUMENT for a context without a cost file.
+ */
+
+/* Engines: "columnar" needs an image with the word columns (every image built
+ * by dict-build and every loaded word list has them), "bounded" needs
+ * max_lev_diff of at most 8, "classic" always works. suggest_query() fails
+ * with SUGGEST_ERR_ARGUMENT when the named engine is unknown or unusable.
+ * The automatic choice is the engine suggest_calibrate() found fastest for the
+ * distance (plain, damerau or weighted) and max_lev_diff of the query, the
+ * first usable one in that order without calibration.
+ */
+
+/* Called once per suggestion from the thread that called suggest_query().
+ * word is not zero terminated and stays valid until suggest_close(), except
+ * for the words of a front-coded image, decoded for the callback only.
+ */
+typedef void (*suggest_callback) (const char *word, size_t word_length, int distance, void *user_data);
+
+void suggest_default_options (struct SuggestOptions *opts);
+void suggest_default_params (struct SuggestParams *params);
+
+/* Loads the dictionary: an image built by dict-build -f image, or a word list
+ * with one word per line. Images are mapped, so they are shared by all
+ * processes through the page cache already. Returns NULL on failure and
+ * stores the reason into *error when error is not NULL (SUGGEST_ERR_FORMAT
+ * for a malformed cost file too).
+ * Front-coded images (dict-build -f compact) take about five times less
+ * memory than full images, and less than the word list itself by a margin
+ * that depends on the word lengths. They are decoded block by block as they
+ * are scanned and only have what suggest_query() needs: the functions needing
+ * the word hash, the columns or the sorted index fail on them with
+ * SUGGEST_ERR_FORMAT.
+ * With an alphabet, queries are case folded and remapped the same way once,
+ * distances count characters instead of bytes, and words are reported as
+ * their case folded text.
+ */
+struct SuggestContext *suggest_open (const char *dict_path, const struct SuggestOptions *opts, int *error);
+void suggest_close (struct SuggestContext *ctx);
+
+/* Times every usable engine on the first 16384 or so words a query of word
+ * with params would scan, and keeps the fastest one as the automatic choice
+ * of the queries with the same distance and max_lev_diff (params->engine and
+ * params->deadline_us are not used). A dictionary too small for that to pay
+ * off keeps the first usable engine. This is the only call that changes an
+ * open context: it must not run alongside queries on it. Returns the errors
+ * of suggest_query().
+ */
+int suggest_calibrate (struct SuggestContext *ctx, const char *word, const struct SuggestParams *params);
+
+/* Reports every dictionary word within params->max_lev_diff of word (and whose
+ * length differs by no more than params->max_length_diff) through callback.
+ * Partitions are scanned most promising first: the most frequent words of
+ * every length before the less frequent ones, and nearest lengths first among
+ * those. Suggestions come in that order. When params->deadline_us expires the
+ * scan stops, the suggestions found so far are reported and SUGGEST_PARTIAL
+ * is returned. Distances are reported in a byte: a word longer than UINT8_MAX
+ * bytes (characters with an alphabet) or a max_lev_diff of UINT8_MAX or more
+ * is rejected with SUGGEST_ERR_ARGUMENT.
+ */
+int suggest_query (const struct SuggestContext *ctx, const char *word, const struct SuggestParams *params,
+				   suggest_callback callback, void *user_data);
+
+/* Dictionary layers, e.g. a general dictionary, then a domain one, then the
+ * words of a user: a later layer takes precedence over the earlier ones. Its
+ * tombstones (a dictionary too, NULL for none) remove words from the earlier
+ * layers, not from its own.
+ */
+struct SuggestLayer {
+	const struct SuggestContext *ctx;
+	const struct SuggestContext *tombstones;
+};
+
+/* suggest_query() over count layers at once: the partitions of all layers
+ * are scanned in one schedule by one set of params->threads workers, so it
+ * costs about one query over the union. A word in several layers is reported
+ * once, from the last one, and not at all when removed by the tombstones of a
+ * later layer. Suggestions come layer by layer, the last layer first. Every
+ * layer and tombstone dictionary needs the word hash (SUGGEST_ERR_FORMAT
+ * otherwise, see suggest_contains()).
+ */
+int suggest_query_layers (const struct SuggestLayer *layers, size_t count, const char *word,
+						  const struct SuggestParams *params, suggest_callback callback, void *user_data);
+
+/* Whether word is in the dictionary: 1 or 0 after a single hash lookup, or
+ * SUGGEST_ERR_FORMAT for an image built without the word hash.
+ */
+int suggest_contains (const struct SuggestContext *ctx, const char *word);
+
+/* suggest_contains() of count words at once: found[i] is set to 1 or 0 for
+ * words[i]. The lookups are interleaved so that the cache misses of one word
+ * overlap with those of the others, which pays off from a few words on with a
+ * dictionary much larger than the cache. Returns SUGGEST_OK, or
+ * SUGGEST_ERR_FORMAT like suggest_contains().
+ */
+int suggest_contains_batch (const struct SuggestContext *ctx, const char *const *words, size_t count, uint8_t *found);
+
+/* Dictionary index of a word reported by suggest_query(), suggest_complete()
+ * or a session on ctx: its position in the dictionary, from 0 to the word
+ * count - 1, in partition order. Stable for a given dictionary file, so it can
+ * stand for the word in machine output. Returns SUGGEST_ERR_ARGUMENT for a
+ * pointer that is not the start of a word of ctx, SUGGEST_ERR_FORMAT for an
+ * image built without the word columns. Takes a binary search.
+ */
+int64_t suggest_word_index (const struct SuggestContext *ctx, const char *word);
+
+/* The word at a dictionary index (see suggest_word_index()), NULL when there
+ * is none. Stores its length into *length; the word is not zero terminated.
+ */
+const char *suggest_word (const struct SuggestContext *ctx, uint64_t index, size_t *length);
+
+/* Type-ahead completion: reports the dictionary words starting with a prefix
+ * within params->max_lev_diff of the given prefix, best first (by distance,
+ * then shorter words), at most limit of them. Runs in the calling thread over
+ * the sorted word index, visiting every shared prefix once and skipping whole
+ * ranges of words whose common prefix is already too far; once limit words are
+ * kept, words that cannot beat the worst of them are skipped the same way.
+ * Levenstein distance only: params->damerau, params->weighted and a negative
+ * max_lev_diff are rejected with SUGGEST_ERR_ARGUMENT.
+ */
+int suggest_complete (const struct SuggestContext *ctx, const char *prefix, const struct SuggestParams *params,
+					  size_t limit, suggest_callback callback, void *user_data);
+
+/* Same as suggest_query() over a word list that is not loaded: the file is
+ * read front to back in large blocks on a reader thread while the calling
+ * thread scores the previous block, so memory use stays at two blocks
+ * whatever the file size. Meant for word lists too large to load; images are
+ * not accepted. Suggestions come in file order, and word is only valid
+ * during the callback. params->threads is not used, params->weighted is
+ * rejected with SUGGEST_ERR_ARGUMENT (there is no cost file).
+ */
+int suggest_stream_query (const char *dict_path, const char *word, const struct SuggestParams *params,
+						  suggest_callback callback, void *user_data);
+
+/* Type-as-you-go sessions: the query grows one character at a time, and
+ * every dictionary word keeps the last row of its levenstein DP against the
+ * query so far, so a new character costs one row per word still in the race.
+ * A word none of whose prefixes is within params->max_lev_diff of the query
+ * is dropped for good, so keystrokes get cheaper as the query grows.
+ * A session belongs to one thread; the context must outlive it. Unweighted
+ * levenstein distance only, like suggest_complete(), and not on front-coded images
+ * (SUGGEST_ERR_FORMAT).
+ */
+struct SuggestSession;
+
+struct SuggestSession *suggest_session_open (const struct SuggestContext *ctx, const struct SuggestParams *params,
+										   int *error);
+void suggest_session_close (struct SuggestSession *session);
+
+/* Appends length characters of text to the query and reports the words within
+ * params->max_lev_diff (and params->max_length_diff) of the whole query, in
+ * dictionary order.
+ */
+int suggest_session_append (struct SuggestSession *session, const char *text, size_t length,
+							suggest_callback callback, void *user_data);
+
+/* Starts over with an empty query, e.g. when the input was edited other than
+ * by appending */
+void suggest_session_reset (struct SuggestSession *session);
+
+/* Describes an error code */
+const char *suggest_strerror (int error);
+
+#endif
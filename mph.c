@@ -0,0 +1,277 @@
+/** 
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2013, Valera Leontyev.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *  - this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *  - this list of conditions and the following disclaimer in the documentation
+ *  - and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of the Valera Leontyev nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "mph.h"
+#include "libsuggest.h"
+
+#define MPH_SEEDS 16          // seeds tried before giving up
+#define MPH_TRIES (1u << 20)  // displacements tried per bucket with a seed
+
+#define FNV_OFFSET 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+struct MphKey {
+	uint64_t bucket;
+	uint64_t f1;
+	uint64_t f2;
+};
+
+static uint64_t mph_mix (uint64_t x)
+{
+	x ^= x >> 30;
+	x *= 0xbf58476d1ce4e5b9ULL;
+	x ^= x >> 27;
+	x *= 0x94d049bb133111ebULL;
+	x ^= x >> 31;
+	return x;
+}
+
+static void mph_key (const struct MphHeader *header, const char *key, size_t length, struct MphKey *hashed)
+{
+	uint64_t hash = FNV_OFFSET;
+	for (size_t i = 0; i < length; i++) {
+		hash ^= (unsigned char)key[i];
+		hash *= FNV_PRIME;
+	}
+	hash = mph_mix(hash ^ header->seed);
+	hashed->bucket = hash % header->bucket_count;
+	hashed->f1 = mph_mix(hash + 1) % header->slot_count;
+	hashed->f2 = header->slot_count > 1 ? mph_mix(hash + 2) % (header->slot_count - 1) + 1 : 0;
+}
+
+static uint64_t mph_slot (const struct MphHeader *header, const struct MphKey *hashed, struct MphDisplacement d)
+{
+	// n is at most UINT32_MAX, so none of this overflows
+	uint64_t n = header->slot_count;
+	return (hashed->f1 + (uint64_t)d.d0 * hashed->f2 % n + d.d1) % n;
+}
+
+static struct MphDisplacement *mph_displacements (const struct MphHeader *header)
+{
+	return (struct MphDisplacement *)(header + 1);
+}
+
+static uint64_t *mph_values (const struct MphHeader *header)
+{
+	return (uint64_t *)(mph_displacements(header) + header->bucket_count);
+}
+
+size_t mph_size (size_t count)
+{
+	if (!count || count > UINT32_MAX) {
+		return 0;
+	}
+	size_t bucket_count = (count + MPH_BUCKET_KEYS - 1) / MPH_BUCKET_KEYS;
+	return sizeof(struct MphHeader) + bucket_count * sizeof(struct MphDisplacement) + count * sizeof(uint64_t);
+}
+
+static int mph_place (struct MphHeader *header, size_t count, const struct MphKey *hashed, uint8_t *taken);
+
+int mph_build (void *mph, size_t count, const char *const *keys, const uint8_t *lengths, const uint64_t *values)
+{
+	if (!mph_size(count)) {
+		return SUGGEST_ERR_ARGUMENT;
+	}
+
+	struct MphHeader *header = mph;
+	header->bucket_count = (count + MPH_BUCKET_KEYS - 1) / MPH_BUCKET_KEYS;
+	header->slot_count = count;
+
+	struct MphKey *hashed = malloc(count * sizeof(*hashed));
+	uint8_t *taken = malloc(count);
+	if (!hashed || !taken) {
+		free(hashed);
+		free(taken);
+		return SUGGEST_ERR_NOMEM;
+	}
+
+	int r = SUGGEST_ERR_FORMAT;
+	for (uint64_t seed = 0; seed < MPH_SEEDS && r == SUGGEST_ERR_FORMAT; seed++) {
+		header->seed = seed;
+		for (size_t i = 0; i < count; i++) {
+			mph_key(header, keys[i], lengths[i], &hashed[i]);
+		}
+		r = mph_place(header, count, hashed, taken);
+	}
+
+	if (r == SUGGEST_OK) {
+		uint64_t *slots = mph_values(header);
+		struct MphDisplacement *displacements = mph_displacements(header);
+		for (size_t i = 0; i < count; i++) {
+			slots[mph_slot(header, &hashed[i], displacements[hashed[i].bucket])] = values[i];
+		}
+	}
+
+	free(hashed);
+	free(taken);
+	return r;
+}
+
+// Finds the displacements of the buckets, largest buckets first.
+// SUGGEST_ERR_FORMAT means that some bucket does not fit with this seed.
+static int mph_place (struct MphHeader *header, size_t count, const struct MphKey *hashed, uint8_t *taken)
+{
+	uint64_t bucket_count = header->bucket_count;
+	struct MphDisplacement *displacements = mph_displacements(header);
+	memset(displacements, 0, bucket_count * sizeof(*displacements));
+	memset(taken, 0, count);
+
+	// Keys grouped by bucket, buckets ordered by size
+	uint64_t *starts = calloc(bucket_count + 1, sizeof(*starts));
+	uint64_t *members = malloc(count * sizeof(*members));
+	uint64_t *order = malloc(bucket_count * sizeof(*order));
+	uint64_t *sizes = calloc(count + 2, sizeof(*sizes));
+	if (!starts || !members || !order || !sizes) {
+		free(starts);
+		free(members);
+		free(order);
+		free(sizes);
+		return SUGGEST_ERR_NOMEM;
+	}
+	for (size_t i = 0; i < count; i++) {
+		starts[hashed[i].bucket + 1]++;
+	}
+	for (uint64_t b = 0; b < bucket_count; b++) {
+		sizes[starts[b + 1]]++;
+		starts[b + 1] += starts[b];
+	}
+	uint64_t *fill = malloc(bucket_count * sizeof(*fill));
+	if (!fill) {
+		free(starts);
+		free(members);
+		free(order);
+		free(sizes);
+		return SUGGEST_ERR_NOMEM;
+	}
+	memcpy(fill, starts, bucket_count * sizeof(*fill));
+	for (size_t i = 0; i < count; i++) {
+		members[fill[hashed[i].bucket]++] = i;
+	}
+	// Counting sort by descending size
+	for (uint64_t size = count + 1, position = 0; size-- > 0;) {
+		uint64_t buckets = sizes[size];
+		sizes[size] = position;
+		position += buckets;
+	}
+	for (uint64_t b = 0; b < bucket_count; b++) {
+		order[sizes[starts[b + 1] - starts[b]]++] = b;
+	}
+	free(fill);
+	free(sizes);
+
+	int r = SUGGEST_OK;
+	uint64_t free_slot = 0;
+	for (uint64_t i = 0; i < bucket_count && r == SUGGEST_OK; i++) {
+		uint64_t bucket = order[i];
+		uint64_t size = starts[bucket + 1] - starts[bucket];
+		const uint64_t *keys = members + starts[bucket];
+		if (!size) {
+			continue;
+		}
+
+		if (size == 1) {
+			// A single key takes the next free slot directly
+			while (taken[free_slot]) {
+				free_slot++;
+			}
+			const struct MphKey *key = &hashed[keys[0]];
+			displacements[bucket].d1 = (uint32_t)((free_slot + header->slot_count - key->f1) % header->slot_count);
+			taken[free_slot] = 1;
+			continue;
+		}
+
+		// d1 moves the keys along with d0: with d0 alone, a key whose f2 shares a
+		// large factor with the slot count only reaches a few slots
+		r = SUGGEST_ERR_FORMAT;
+		for (uint32_t d0 = 0; d0 < MPH_TRIES && r != SUGGEST_OK; d0++) {
+			struct MphDisplacement d = { d0, (uint32_t)(mph_mix(d0) % header->slot_count) };
+			uint64_t placed = 0;
+			for (; placed < size; placed++) {
+				uint64_t slot = mph_slot(header, &hashed[keys[placed]], d);
+				if (taken[slot]) {
+					break;
+				}
+				taken[slot] = 1;
+			}
+			if (placed == size) {
+				displacements[bucket] = d;
+				r = SUGGEST_OK;
+			} else {
+				for (uint64_t j = 0; j < placed; j++) {
+					taken[mph_slot(header, &hashed[keys[j]], d)] = 0;
+				}
+			}
+		}
+	}
+
+	free(starts);
+	free(members);
+	free(order);
+	return r;
+}
+
+uint64_t mph_value (const void *mph, const char *key, size_t length)
+{
+	const struct MphHeader *header = mph;
+	struct MphKey hashed;
+	mph_key(header, key, length, &hashed);
+	return mph_values(header)[mph_slot(header, &hashed, mph_displacements(header)[hashed.bucket])];
+}
+
+void mph_value_batch (const void *mph, size_t count, const char *const *keys, const size_t *lengths,
+					  uint64_t *values)
+{
+	const struct MphHeader *header = mph;
+	const struct MphDisplacement *displacements = mph_displacements(header);
+	const uint64_t *slots = mph_values(header);
+	struct MphKey hashed[MPH_BATCH];
+	uint64_t slot[MPH_BATCH];
+
+	for (size_t first = 0; first < count; first += MPH_BATCH) {
+		size_t batch = count - first < MPH_BATCH ? count - first : MPH_BATCH;
+		for (size_t i = 0; i < batch; i++) {
+			mph_key(header, keys[first + i], lengths[first + i], &hashed[i]);
+			__builtin_prefetch(&displacements[hashed[i].bucket]);
+		}
+		for (size_t i = 0; i < batch; i++) {
+			slot[i] = mph_slot(header, &hashed[i], displacements[hashed[i].bucket]);
+			__builtin_prefetch(&slots[slot[i]]);
+		}
+		for (size_t i = 0; i < batch; i++) {
+			values[first + i] = slots[slot[i]];
+		}
+	}
+}
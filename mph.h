@@ -0,0 +1,83 @@
+/** 
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2013, Valera Leontyev.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *  - this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *  - this list of conditions and the following disclaimer in the documentation
+ *  - and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of the Valera Leontyev nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef MPH_H_INCLUDED
+#define MPH_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Minimal perfect hash (CHD, "compress, hash and displace"): maps each of n
+ * keys known in advance to its own slot in [0, n). Keys are hashed into
+ * buckets of about MPH_BUCKET_KEYS keys, and each bucket stores the
+ * displacement that sends all of its keys to free slots. A key that was not
+ * in the set lands on some slot too, so the caller checks the slot's key.
+ *
+ * struct MphHeader | struct MphDisplacement per bucket | uint64_t value per slot
+ */
+
+#define MPH_BUCKET_KEYS 4
+
+struct MphHeader {
+	uint64_t seed;
+	uint64_t bucket_count;
+	uint64_t slot_count;
+};
+
+struct MphDisplacement {
+	uint32_t d0;
+	uint32_t d1;
+};
+
+/* Size of the hash over count keys, 0 when there are too many keys */
+size_t mph_size (size_t count);
+
+/* Builds the hash into mph (mph_size(count) bytes): the slot of keys[i]
+ * holds values[i]. Keys must be distinct.
+ */
+int mph_build (void *mph, size_t count, const char *const *keys, const uint8_t *lengths, const uint64_t *values);
+
+/* Value of the slot the key hashes to */
+uint64_t mph_value (const void *mph, const char *key, size_t length);
+
+/* mph_value() of count keys, stored into values. A lookup is two dependent
+ * cache misses (displacement, then value) on a large hash, so up to
+ * MPH_BATCH keys go through each step together: the loads of one step are
+ * prefetched for every key before any of them is used, and their misses
+ * overlap.
+ */
+#define MPH_BATCH 16
+void mph_value_batch (const void *mph, size_t count, const char *const *keys, const size_t *lengths,
+					  uint64_t *values);
+
+#endif
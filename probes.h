@@ -0,0 +1,80 @@
+/** 
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2013, Valera Leontyev.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *  - this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *  - this list of conditions and the following disclaimer in the documentation
+ *  - and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of the Valera Leontyev nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PROBES_H_INCLUDED
+#define PROBES_H_INCLUDED
+
+/* USDT probes of provider libsuggest, for bpftrace, perf or systemtap:
+ *
+ *   query__start      word, word length, max_length_diff, max_lev_diff
+ *   query__engine     word, engine name
+ *   query__end        word, suggestions reported, result code
+ *   worker__start     worker index
+ *   worker__end       worker index, partitions scanned, result code
+ *   partition__done   worker index, partition, words in it, suggestions found
+ *   result            word, word length, distance (not zero terminated)
+ *
+ * They are built in with SUGGEST_USDT (make USDT=1, the default) when
+ * <sys/sdt.h> is there, and compile to nothing otherwise. A probe nobody is
+ * attached to costs a nop.
+ */
+
+#if defined(SUGGEST_USDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define SUGGEST_PROBES 1
+#endif
+#endif
+
+#ifdef SUGGEST_PROBES
+#define PROBE_QUERY_START(word, length, max_length_diff, max_lev_diff) \
+	DTRACE_PROBE4(libsuggest, query__start, word, length, max_length_diff, max_lev_diff)
+#define PROBE_QUERY_ENGINE(word, engine) DTRACE_PROBE2(libsuggest, query__engine, word, engine)
+#define PROBE_QUERY_END(word, results, error) DTRACE_PROBE3(libsuggest, query__end, word, results, error)
+#define PROBE_WORKER_START(worker) DTRACE_PROBE1(libsuggest, worker__start, worker)
+#define PROBE_WORKER_END(worker, partitions, error) \
+	DTRACE_PROBE3(libsuggest, worker__end, worker, partitions, error)
+#define PROBE_PARTITION_DONE(worker, partition, words, results) \
+	DTRACE_PROBE4(libsuggest, partition__done, worker, partition, words, results)
+#define PROBE_RESULT(word, length, distance) DTRACE_PROBE3(libsuggest, result, word, length, distance)
+#else
+#define PROBE_QUERY_START(word, length, max_length_diff, max_lev_diff) do {} while (0)
+#define PROBE_QUERY_ENGINE(word, engine) do {} while (0)
+#define PROBE_QUERY_END(word, results, error) do {} while (0)
+#define PROBE_WORKER_START(worker) do {} while (0)
+#define PROBE_WORKER_END(worker, partitions, error) do {} while (0)
+#define PROBE_PARTITION_DONE(worker, partition, words, results) do {} while (0)
+#define PROBE_RESULT(word, length, distance) do {} while (0)
+#endif
+
+#endif
@@ -0,0 +1,400 @@
+/** 
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2013, Valera Leontyev.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *  - this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *  - this list of conditions and the following disclaimer in the documentation
+ *  - and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of the Valera Leontyev nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "suggest2.h"
+
+struct ShardServer {
+	const struct SuggestContext *ctx;
+	const struct SuggestParams *params;
+};
+
+struct ShardConnection {
+	int fd;
+	const struct ShardServer *server;
+};
+
+struct ShardReply {
+	int fd;
+	struct OutputBuffer buffer;
+	size_t parsed;
+	int status; // -1 while the end record has not arrived
+};
+
+struct ShardSuggestion {
+	const char *word;
+	uint8_t length;
+	uint8_t distance;
+	size_t order;
+};
+
+// I/O helpers
+
+static int read_full (int fd, void *data, size_t size)
+{
+	size_t done = 0;
+	while (done < size) {
+		ssize_t r = read(fd, (char *)data + done, size - done);
+		if (r == -1 && errno == EINTR) continue;
+		if (r <= 0) return -1;
+		done += r;
+	}
+	return 0;
+}
+
+static int write_full (int fd, const void *data, size_t size)
+{
+	size_t done = 0;
+	while (done < size) {
+		ssize_t r = write(fd, (const char *)data + done, size - done);
+		if (r == -1 && errno == EINTR) continue;
+		if (r <= 0) return -1;
+		done += r;
+	}
+	return 0;
+}
+
+static int socket_address (const char *path, struct sockaddr_un *addr)
+{
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr->sun_path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	strcpy(addr->sun_path, path);
+	return 0;
+}
+
+static long remaining_ms (struct timespec deadline)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	long ms = (deadline.tv_sec - now.tv_sec) * 1000 + (deadline.tv_nsec - now.tv_nsec) / 1000000;
+	return ms > 0 ? ms : 0;
+}
+
+// Shard set
+
+int shard_set_parse (struct ShardSet *shards, const char *list, int timeout_ms)
+{
+	shards->count = 1;
+	for (const char *c = list; *c; c++) {
+		shards->count += *c == ',';
+	}
+	shards->paths = calloc(shards->count, sizeof(char *));
+	char *copy = strdup(list);
+	if (!shards->paths || !copy) {
+		return -1;
+	}
+	int i = 0;
+	for (char *path = strtok(copy, ","); path; path = strtok(NULL, ",")) {
+		shards->paths[i++] = path;
+	}
+	shards->count = i;
+	shards->timeout_ms = timeout_ms;
+	return i ? 0 : -1;
+}
+
+// Server
+
+static void shard_append_suggestion (const char *word, size_t word_length, int distance, void *user_data)
+{
+	uint8_t record[2] = { (uint8_t)distance, (uint8_t)word_length };
+	output_append(user_data, (const char *)record, sizeof(record));
+	output_append(user_data, word, word_length);
+}
+
+static void *shard_connection (void *arg)
+{
+	struct ShardConnection *connection = arg;
+	const struct ShardServer *server = connection->server;
+
+	while (1) {
+		uint8_t header[SHARD_REQUEST_HEADER];
+		if (read_full(connection->fd, header, sizeof(header)) == -1) {
+			break;
+		}
+		char word[UINT8_MAX + 1];
+		uint8_t word_length = header[4];
+		if (read_full(connection->fd, word, word_length) == -1) {
+			break;
+		}
+		word[word_length] = 0;
+
+		struct SuggestParams params = *server->params;
+		int16_t max_length_diff, max_lev_diff;
+		memcpy(&max_length_diff, header, sizeof(int16_t));
+		memcpy(&max_lev_diff, header + 2, sizeof(int16_t));
+		params.max_length_diff = max_length_diff;
+		params.max_lev_diff = max_lev_diff;
+
+		struct OutputBuffer output = { NULL, 0, 0 };
+		int r = suggest_query(server->ctx, word, &params, shard_append_suggestion, &output);
+		uint8_t end[2] = { SHARD_END, r == SUGGEST_OK ? SHARD_STATUS_OK
+			: r == SUGGEST_PARTIAL ? SHARD_STATUS_PARTIAL : SHARD_STATUS_ERROR };
+		if (r < SUGGEST_OK) {
+			output.size = 0;
+		}
+		output_append(&output, (const char *)end, sizeof(end));
+
+		int written = write_full(connection->fd, output.data, output.size);
+		free(output.data);
+		if (written == -1) {
+			break;
+		}
+	}
+
+	close(connection->fd);
+	free(connection);
+	return NULL;
+}
+
+int shard_serve (const char *socket_path, const struct SuggestContext *ctx, const struct SuggestParams *params)
+{
+	signal(SIGPIPE, SIG_IGN);
+
+	struct sockaddr_un addr;
+	if (socket_address(socket_path, &addr) == -1) {
+		return -1;
+	}
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd == -1) {
+		return -1;
+	}
+	unlink(socket_path);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 || listen(fd, SOMAXCONN) == -1) {
+		close(fd);
+		return -1;
+	}
+
+	struct ShardServer server = { ctx, params };
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+	while (1) {
+		int client = accept(fd, NULL, NULL);
+		if (client == -1) {
+			if (errno == EINTR || errno == ECONNABORTED) continue;
+			break;
+		}
+		struct ShardConnection *connection = malloc(sizeof(*connection));
+		pthread_t thread;
+		if (!connection) {
+			close(client);
+			continue;
+		}
+		connection->fd = client;
+		connection->server = &server;
+		if (pthread_create(&thread, &attr, shard_connection, connection)) {
+			close(client);
+			free(connection);
+		}
+	}
+
+	int saved_errno = errno;
+	pthread_attr_destroy(&attr);
+	close(fd);
+	errno = saved_errno;
+	return -1;
+}
+
+// Coordinator
+
+static int shard_connect (const char *path, const char *request, size_t request_size)
+{
+	struct sockaddr_un addr;
+	if (socket_address(path, &addr) == -1) {
+		return -1;
+	}
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd == -1) {
+		return -1;
+	}
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1
+		|| write_full(fd, request, request_size) == -1
+		|| fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) == -1) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+// Advances over the complete records received so far
+static void shard_reply_parse (struct ShardReply *reply)
+{
+	const uint8_t *data = (const uint8_t *)reply->buffer.data;
+	while (reply->status == -1 && reply->parsed + 2 <= reply->buffer.size) {
+		if (data[reply->parsed] == SHARD_END) {
+			reply->status = data[reply->parsed + 1];
+			break;
+		}
+		size_t record_size = 2 + data[reply->parsed + 1];
+		if (reply->parsed + record_size > reply->buffer.size) {
+			break;
+		}
+		reply->parsed += record_size;
+	}
+}
+
+static int shard_suggestion_compare (const void *a, const void *b)
+{
+	const struct ShardSuggestion *left = a, *right = b;
+	if (left->distance != right->distance) {
+		return left->distance < right->distance ? -1 : 1;
+	}
+	return left->order < right->order ? -1 : left->order > right->order;
+}
+
+int shard_query (const struct ShardSet *shards, const char *word, const struct SuggestParams *params,
+				 suggest_callback callback, void *user_data)
+{
+	signal(SIGPIPE, SIG_IGN);
+
+	size_t word_length = strlen(word);
+	if (word_length > UINT8_MAX || params->max_lev_diff >= SHARD_END) {
+		return SUGGEST_ERR_ARGUMENT; // the request has one length byte, records one distance byte
+	}
+	char request[SHARD_REQUEST_HEADER + UINT8_MAX];
+	int16_t max_length_diff = params->max_length_diff, max_lev_diff = params->max_lev_diff;
+	memcpy(request, &max_length_diff, sizeof(int16_t));
+	memcpy(request + 2, &max_lev_diff, sizeof(int16_t));
+	request[4] = (char)word_length;
+	memcpy(request + SHARD_REQUEST_HEADER, word, word_length);
+
+	struct timespec deadline;
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += shards->timeout_ms / 1000;
+	deadline.tv_nsec += (shards->timeout_ms % 1000) * 1000000L;
+	if (deadline.tv_nsec >= 1000000000) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000;
+	}
+
+	// Scatter
+	struct ShardReply replies[shards->count];
+	memset(replies, 0, sizeof(replies));
+	for (int i = 0; i < shards->count; i++) {
+		replies[i].status = -1;
+		replies[i].fd = shard_connect(shards->paths[i], request, SHARD_REQUEST_HEADER + word_length);
+		if (replies[i].fd == -1) {
+			replies[i].status = SHARD_STATUS_ERROR;
+		}
+	}
+
+	// Gather until every shard has answered or the deadline
+	struct pollfd pollfds[shards->count];
+	int pending[shards->count];
+	while (1) {
+		int pending_count = 0;
+		for (int i = 0; i < shards->count; i++) {
+			if (replies[i].status == -1) {
+				pollfds[pending_count].fd = replies[i].fd;
+				pollfds[pending_count].events = POLLIN;
+				pending[pending_count++] = i;
+			}
+		}
+		long timeout = remaining_ms(deadline);
+		if (!pending_count || !timeout) {
+			break;
+		}
+		int ready = poll(pollfds, pending_count, (int)timeout);
+		if (ready == -1 && errno != EINTR) {
+			break;
+		}
+		for (int j = 0; j < pending_count && ready > 0; j++) {
+			if (!pollfds[j].revents) continue;
+			struct ShardReply *reply = &replies[pending[j]];
+			char buf[4096];
+			ssize_t read_bytes = read(reply->fd, buf, sizeof(buf));
+			if (read_bytes > 0) {
+				output_append(&reply->buffer, buf, read_bytes);
+				shard_reply_parse(reply);
+			} else if (read_bytes == 0 || (errno != EAGAIN && errno != EINTR)) {
+				reply->status = SHARD_STATUS_ERROR;
+			}
+		}
+	}
+
+	// Merge by distance, keeping shard order among equal distances
+	int failed = 0;
+	size_t total = 0;
+	for (int i = 0; i < shards->count; i++) {
+		if (replies[i].status != SHARD_STATUS_OK) {
+			failed++;
+		}
+		if (replies[i].status != SHARD_STATUS_OK && replies[i].status != SHARD_STATUS_PARTIAL) {
+			replies[i].parsed = 0;
+		}
+		const uint8_t *data = (const uint8_t *)replies[i].buffer.data;
+		for (size_t offset = 0; offset < replies[i].parsed; offset += 2 + data[offset + 1]) {
+			total++;
+		}
+	}
+
+	struct ShardSuggestion *suggestions = malloc((total ? total : 1) * sizeof(*suggestions));
+	if (!suggestions) {
+		handle_error("malloc for suggestions");
+	}
+	size_t n = 0;
+	for (int i = 0; i < shards->count; i++) {
+		const char *data = replies[i].buffer.data;
+		for (size_t offset = 0; offset < replies[i].parsed; offset += 2 + (uint8_t)data[offset + 1]) {
+			suggestions[n].distance = (uint8_t)data[offset];
+			suggestions[n].length = (uint8_t)data[offset + 1];
+			suggestions[n].word = data + offset + 2;
+			suggestions[n].order = n;
+			n++;
+		}
+	}
+	qsort(suggestions, n, sizeof(*suggestions), shard_suggestion_compare);
+	for (size_t i = 0; i < n; i++) {
+		callback(suggestions[i].word, suggestions[i].length, suggestions[i].distance, user_data);
+	}
+
+	free(suggestions);
+	for (int i = 0; i < shards->count; i++) {
+		if (replies[i].fd != -1) {
+			close(replies[i].fd);
+		}
+		free(replies[i].buffer.data);
+	}
+
+	return failed;
+}
@@ -0,0 +1,84 @@
+/** 
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2013, Valera Leontyev.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *  - this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *  - this list of conditions and the following disclaimer in the documentation
+ *  - and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of the Valera Leontyev nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SHARD_H_INCLUDED
+#define SHARD_H_INCLUDED
+
+#include <stdint.h>
+
+#include "libsuggest.h"
+
+/* Scatter-gather over shard servers.
+ *
+ * A shard server (suggest2 --serve) answers queries for one dictionary shard
+ * on a Unix socket. The coordinator (suggest2 --shards) sends every query to
+ * all shards at once, waits for the answers up to a per-shard timeout and
+ * merges whatever arrived by distance.
+ *
+ * Request:  int16_t max_length_diff, int16_t max_lev_diff, uint8_t length, word
+ * Response: records of uint8_t distance, uint8_t length, word, ended by a
+ *           record with distance SHARD_END and length SHARD_STATUS_*; the
+ *           distances of suggestions stay below it (see suggest_query())
+ */
+
+#define SHARD_END 0xFF
+#define SHARD_STATUS_OK 0
+#define SHARD_STATUS_ERROR 1
+#define SHARD_STATUS_PARTIAL 2
+#define SHARD_REQUEST_HEADER 5
+
+struct ShardSet {
+	char **paths;
+	int count;
+	int timeout_ms;
+};
+
+/* Parses a comma separated list of socket paths. Returns 0 on success.
+ */
+int shard_set_parse (struct ShardSet *shards, const char *list, int timeout_ms);
+
+/* Serves queries on socket_path until killed, one thread per connection.
+ * Returns only on failure, with errno set.
+ */
+int shard_serve (const char *socket_path, const struct SuggestContext *ctx, const struct SuggestParams *params);
+
+/* Runs the query on all shards and passes the merged suggestions to callback,
+ * ordered by distance. Returns the number of shards that failed, did not
+ * answer in time or answered partially because of their own deadline; their
+ * suggestions are missing from the result. SUGGEST_ERR_ARGUMENT for a word
+ * longer than UINT8_MAX bytes or a max_lev_diff of UINT8_MAX or more.
+ */
+int shard_query (const struct ShardSet *shards, const char *word, const struct SuggestParams *params,
+				 suggest_callback callback, void *user_data);
+
+#endif
@@ -0,0 +1,227 @@
+/** 
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2013, Valera Leontyev.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *  - this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *  - this list of conditions and the following disclaimer in the documentation
+ *  - and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of the Valera Leontyev nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "stream.h"
+#include "libsuggest.h"
+
+#ifndef O_DIRECT
+#define O_DIRECT 0
+#endif
+
+static void *stream_reader (void *arg);
+static int stream_read (struct Stream *stream, char *data, off_t offset, size_t *size);
+static void stream_free (struct Stream *stream);
+
+// Consumer
+
+int stream_open (const char *filename, size_t block_size, struct Stream *stream)
+{
+	memset(stream, 0, sizeof(*stream));
+	stream->block_size = (block_size + STREAM_ALIGN - 1) / STREAM_ALIGN * STREAM_ALIGN;
+	if (!stream->block_size) {
+		return SUGGEST_ERR_ARGUMENT;
+	}
+
+	// Direct I/O bypasses the page cache, but not every file system has it
+	stream->direct = O_DIRECT != 0;
+	stream->fd = open(filename, O_RDONLY | O_DIRECT);
+	if (stream->fd == -1 && errno == EINVAL) {
+		stream->direct = 0;
+		stream->fd = open(filename, O_RDONLY);
+	}
+	if (stream->fd == -1) {
+		return SUGGEST_ERR_IO;
+	}
+	if (!stream->direct) {
+		posix_fadvise(stream->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+	}
+
+	for (int i = 0; i < 2; i++) {
+		if (posix_memalign((void **)&stream->buffers[i].data, STREAM_ALIGN, stream->block_size)) {
+			stream->buffers[i].data = NULL;
+			stream_free(stream);
+			return SUGGEST_ERR_NOMEM;
+		}
+	}
+
+	pthread_mutex_init(&stream->lock, NULL);
+	pthread_cond_init(&stream->cond, NULL);
+	if (pthread_create(&stream->reader, NULL, stream_reader, stream)) {
+		pthread_cond_destroy(&stream->cond);
+		pthread_mutex_destroy(&stream->lock);
+		stream_free(stream);
+		return SUGGEST_ERR_THREAD;
+	}
+
+	return SUGGEST_OK;
+}
+
+int stream_next (struct Stream *stream, const char **data, size_t *size)
+{
+	*data = NULL;
+	*size = 0;
+	if (stream->ended) {
+		return SUGGEST_OK;
+	}
+
+	struct StreamBuffer *buffer = &stream->buffers[stream->next];
+	pthread_mutex_lock(&stream->lock);
+	while (!buffer->filled) {
+		pthread_cond_wait(&stream->cond, &stream->lock);
+	}
+	int r = stream->error;
+	pthread_mutex_unlock(&stream->lock);
+
+	if (r == SUGGEST_OK) {
+		*data = buffer->data;
+		*size = buffer->size;
+	}
+	return r;
+}
+
+void stream_release (struct Stream *stream)
+{
+	struct StreamBuffer *buffer = &stream->buffers[stream->next];
+	pthread_mutex_lock(&stream->lock);
+	if (buffer->size < stream->block_size) {
+		stream->ended = 1;
+	}
+	buffer->filled = 0;
+	stream->next ^= 1;
+	pthread_cond_broadcast(&stream->cond);
+	pthread_mutex_unlock(&stream->lock);
+}
+
+void stream_close (struct Stream *stream)
+{
+	pthread_mutex_lock(&stream->lock);
+	stream->stop = 1;
+	pthread_cond_broadcast(&stream->cond);
+	pthread_mutex_unlock(&stream->lock);
+
+	pthread_join(stream->reader, NULL);
+	pthread_cond_destroy(&stream->cond);
+	pthread_mutex_destroy(&stream->lock);
+	stream_free(stream);
+}
+
+// Reader
+
+// Fills the buffers in turn, each one as soon as the consumer gives it back
+static void *stream_reader (void *arg)
+{
+	struct Stream *stream = arg;
+	off_t offset = 0;
+	unsigned current = 0;
+
+	while (1) {
+		struct StreamBuffer *buffer = &stream->buffers[current];
+		pthread_mutex_lock(&stream->lock);
+		while (buffer->filled && !stream->stop) {
+			pthread_cond_wait(&stream->cond, &stream->lock);
+		}
+		uint8_t stop = stream->stop;
+		pthread_mutex_unlock(&stream->lock);
+		if (stop) {
+			break;
+		}
+
+		size_t size;
+		int r = stream_read(stream, buffer->data, offset, &size);
+		offset += size;
+
+		pthread_mutex_lock(&stream->lock);
+		buffer->size = size;
+		buffer->filled = 1;
+		stream->error = r;
+		pthread_cond_broadcast(&stream->cond);
+		pthread_mutex_unlock(&stream->lock);
+
+		if (r != SUGGEST_OK || size < stream->block_size) {
+			break;
+		}
+		current ^= 1;
+	}
+
+	return NULL;
+}
+
+// Reads a whole block unless the file ends first
+static int stream_read (struct Stream *stream, char *data, off_t offset, size_t *size)
+{
+	*size = 0;
+	while (*size < stream->block_size) {
+		ssize_t read_bytes = pread(stream->fd, data + *size, stream->block_size - *size, offset + *size);
+		if (read_bytes == -1 && errno == EINTR) {
+			continue;
+		}
+		if (read_bytes == -1 && errno == EINVAL && stream->direct) {
+			// Direct I/O refused (e.g. the unaligned tail of the file), go on through the page cache
+			int flags = fcntl(stream->fd, F_GETFL);
+			if (flags == -1 || fcntl(stream->fd, F_SETFL, flags & ~O_DIRECT) == -1) {
+				return SUGGEST_ERR_IO;
+			}
+			stream->direct = 0;
+			continue;
+		}
+		if (read_bytes == -1) {
+			return SUGGEST_ERR_IO;
+		}
+		if (!read_bytes) {
+			break;
+		}
+		*size += read_bytes;
+	}
+
+	if (!stream->direct && *size) {
+		posix_fadvise(stream->fd, offset, *size, POSIX_FADV_DONTNEED);
+	}
+	return SUGGEST_OK;
+}
+
+static void stream_free (struct Stream *stream)
+{
+	close(stream->fd);
+	for (int i = 0; i < 2; i++) {
+		free(stream->buffers[i].data);
+		stream->buffers[i].data = NULL;
+	}
+}
@@ -0,0 +1,87 @@
+/** 
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2013, Valera Leontyev.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *  - this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *  - this list of conditions and the following disclaimer in the documentation
+ *  - and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of the Valera Leontyev nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef STREAM_H_INCLUDED
+#define STREAM_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+/* Block stream: reads a file front to back in large aligned blocks on a
+ * reader thread, so that the consumer works on one block while the next one
+ * is being read. Two buffers take turns, whatever the file size.
+ *
+ * The file is opened with O_DIRECT where the file system allows it; otherwise
+ * it is read through the page cache and every block read is dropped from the
+ * cache right away, so a long scan does not push everything else out.
+ */
+
+#define STREAM_BLOCK_SIZE (4 << 20)
+#define STREAM_ALIGN 4096
+
+struct StreamBuffer {
+	char *data;
+	size_t size;    // bytes read into the block, less than block_size at end of file
+	uint8_t filled; // owned by the consumer until stream_release()
+};
+
+struct Stream {
+	int fd;
+	uint8_t direct;
+	size_t block_size;
+	struct StreamBuffer buffers[2];
+	unsigned next;  // buffer the consumer takes next
+	uint8_t ended;  // the consumer has released the last block
+	uint8_t stop;
+	int error;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	pthread_t reader;
+};
+
+/* Opens the file and starts reading. block_size is rounded up to
+ * STREAM_ALIGN.
+ */
+int stream_open (const char *filename, size_t block_size, struct Stream *stream);
+
+/* Waits for the next block. *size is 0 at end of file. The block stays valid
+ * until stream_release().
+ */
+int stream_next (struct Stream *stream, const char **data, size_t *size);
+void stream_release (struct Stream *stream);
+
+/* Stops the reader and frees the buffers, at any point of the scan */
+void stream_close (struct Stream *stream);
+
+#endif
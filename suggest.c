@@ -188,15 +188,13 @@ void print_closest_iterations (FILE *stream, int start, int stop, int step, cons
 			     			   size_t word_len, const char *word, short max_length_diff, short max_lev_diff)
 {
 	// printf("%d\t%d\t%d\t%d\n", getpid(), start, stop, step); // DEBUG
-	size_t* levenstein_buffer = levenstein_init_buffer(segment_size);
 	for (int i = start; i < stop; i += step) {
 		const char *segment = data + segment_size * i;
-		print_closest_segment(stream, levenstein_buffer, segment, segment_size, word_len, word, max_length_diff, max_lev_diff);
+		print_closest_segment(stream, segment, segment_size, word_len, word, max_length_diff, max_lev_diff);
 	}
-	levenstein_free_buffer(levenstein_buffer);
 }
 
-void print_closest_segment (FILE *stream, size_t* levenstein_buffer, const char *segment, uint8_t segment_size, 
+void print_closest_segment (FILE *stream, const char *segment, uint8_t segment_size, 
 							size_t word_len, const char *word, short max_length_diff, short max_lev_diff)
 {
 	uint8_t segment_length = (uint8_t)strlen(segment);
@@ -210,7 +208,7 @@ void print_closest_segment (FILE *stream, size_t* levenstein_buffer, const char
 		size_t result;
 		if (abs(word_len - segment_len) <= max_length_diff) {
 			
-			result = levenstein(word, word_len, segment, segment_len, levenstein_buffer, segment_size);
+			result = levenstein(word, word_len, segment, segment_len);
 			if (result <= max_lev_diff) {
 				fprintf(stream, "%d\t%s\n", (int)result, segment);
 			}
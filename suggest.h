@@ -66,7 +66,7 @@ void print_closest_fork (const char *data, uint8_t segment_size, int segments_co
 						 const char *word, short max_length_diff, short max_lev_diff, short parallel_proc_count);
 void print_closest_iterations (FILE *stream, int start, int stop, int step, const char *data, uint8_t segment_size,
                                size_t word_len, const char *word, short max_length_diff, short max_lev_diff);
-void print_closest_segment (FILE *stream, size_t* levenstein_buffer, const char *segment, uint8_t segment_size,
+void print_closest_segment (FILE *stream, const char *segment, uint8_t segment_size,
 							size_t word_len, const char *word, short max_length_diff, short max_lev_diff);
 
 // Options
@@ -44,11 +44,91 @@ int main (const int argc, const char **argv)
 	opts.max_lev_diff = 5; 
 	opts.parallel_proc_count = 4;
 	opts.file_name = "dictionary";
+	opts.layer_files = NULL;
+	opts.tombstone_files = NULL;
+	opts.layer_count = 0;
+	opts.layered = 0;
+	opts.cache_file = NULL;
+	opts.cache_slots = CACHE_DEFAULT_SLOTS;
+	opts.serve_socket = NULL;
+	opts.shard_list = NULL;
+	opts.shard_timeout_ms = 1000;
+	opts.complete = 0;
+	opts.limit = 10;
+	opts.deadline_us = 0;
+	opts.stream = 0;
+	opts.shared_name = NULL;
+	opts.alphabet = NULL;
+	opts.engine = NULL;
+	opts.session = 0;
+	opts.exact_first = 0;
+	opts.damerau = 0;
+	opts.costs = NULL;
+	opts.format = OUTPUT_TEXT;
 	
 	read_opts(argc, argv, &opts);
 
-	char *dict;
-	size_t dict_size = load_dict(opts.file_name, &dict, opts.parallel_proc_count);
+	struct SuggestParams params;
+	suggest_default_params(&params);
+	params.max_length_diff = opts.max_length_diff;
+	params.max_lev_diff = opts.max_lev_diff;
+	params.threads = opts.parallel_proc_count;
+	params.deadline_us = opts.deadline_us;
+	params.engine = opts.engine;
+	params.damerau = opts.damerau;
+	params.weighted = opts.costs != NULL;
+	params.exact_first = opts.layered && opts.exact_first;
+
+	struct RecordWriter *records = NULL;
+	if (opts.format != OUTPUT_TEXT) {
+		if (!(records = calloc(1, sizeof(*records)))) {
+			handle_error("calloc for records");
+		}
+		records->format = opts.format;
+		records->copy_words = opts.stream || opts.shard_list;
+	}
+
+	if (opts.serve_socket) {
+		struct SuggestContext *ctx = open_dict(&opts);
+		shard_serve(opts.serve_socket, ctx, &params);
+		handle_error("shard_serve");
+	}
+
+	if (opts.session) {
+		struct SuggestContext *ctx = open_dict(&opts);
+		run_session(ctx, &params, records);
+		suggest_close(ctx);
+		exit(EXIT_SUCCESS);
+	}
+
+	struct ShardSet shards;
+	if (opts.shard_list && shard_set_parse(&shards, opts.shard_list, opts.shard_timeout_ms) == -1) {
+		fprintf(stderr, "Invalid shard list %s\n", opts.shard_list);
+		exit(EXIT_FAILURE);
+	}
+
+	struct Cache cache;
+	uint64_t dict_hash = 0;
+	if (opts.cache_file) {
+		if (cache_open(&cache, opts.cache_file, opts.cache_slots) == -1) {
+			handle_error("cache_open");
+		}
+		if (cache_dict_hash(&cache, opts.file_name, &dict_hash) == -1) {
+			handle_error("cache_dict_hash");
+		}
+	}
+
+	// Dictionary is loaded on the first cache miss only
+	struct SuggestContext *ctx = NULL;
+	struct SuggestLayer *layers = opts.layered ? open_layers(&opts) : NULL;
+	for (size_t layer = 0; layers && opts.words[0] && layer < opts.layer_count; layer++) {
+		calibrate_dict((struct SuggestContext *)layers[layer].ctx, opts.words[0], &params);
+	}
+	int calibrated = 0;
+	uint8_t *known_words = NULL;
+	if (opts.exact_first && !layers && !(known_words = malloc(opts.words_count ? opts.words_count : 1))) {
+		handle_error("malloc for known words");
+	}
 
 	struct timespec start_point;
 	clock_gettime(CLOCK_MONOTONIC, &start_point);
@@ -59,11 +139,114 @@ int main (const int argc, const char **argv)
 		struct timespec before_point;
 		clock_gettime(CLOCK_MONOTONIC, &before_point);
 
+		// Known words are looked up all at once, their misses overlap
+		if (known_words) {
+			if (!ctx) {
+				ctx = open_dict(&opts);
+			}
+			int error = suggest_contains_batch(ctx, opts.words, opts.words_count, known_words);
+			if (error != SUGGEST_OK) {
+				fprintf(stderr, "%s: %s\n", opts.file_name, suggest_strerror(error));
+				exit(EXIT_FAILURE);
+			}
+		}
+
 		int word_index = 0;
 		while (opts.words[word_index]) {
-			print_closest(dict, dict_size, opts.words[word_index], opts.max_length_diff, opts.max_lev_diff, opts.parallel_proc_count);
+			const char *word = opts.words[word_index];
+			struct OutputBuffer output = { NULL, 0, 0 };
+			suggest_callback callback = records ? record_suggestion : output_suggestion;
+			void *user_data = records ? (void *)records : (void *)&output;
+
+			int known = known_words && known_words[word_index];
+
+			if (records) {
+				records->ctx = opts.stream || opts.shard_list || layers ? NULL : ctx;
+				records->query = word_index;
+			}
+
+			if (known) {
+				// Known words skip the search and the cache, the query only
+				// reports the dictionary copy of the word
+				struct SuggestParams known_params = params;
+				known_params.exact_first = 1;
+				suggest_query(ctx, word, &known_params, callback, user_data);
+
+			} else if (opts.complete) {
+				if (!ctx) {
+					ctx = open_dict(&opts);
+				}
+				if (records) {
+					records->ctx = ctx;
+				}
+				int error = suggest_complete(ctx, word, &params, opts.limit, callback, user_data);
+				if (error != SUGGEST_OK) {
+					fprintf(stderr, "%s: %s\n", word, suggest_strerror(error));
+					exit(EXIT_FAILURE);
+				}
+
+			} else if (layers) {
+				// Words come from several dictionaries, they have no index
+				int error = suggest_query_layers(layers, opts.layer_count, word, &params, callback, user_data);
+				if (error < SUGGEST_OK) {
+					fprintf(stderr, "%s: %s\n", word, suggest_strerror(error));
+					exit(EXIT_FAILURE);
+				}
+				if (error == SUGGEST_PARTIAL) {
+					fprintf(stderr, "%s: %s\n", word, suggest_strerror(error));
+				}
+
+			} else if (opts.stream) {
+				int error = suggest_stream_query(opts.file_name, word, &params, callback, user_data);
+				if (error < SUGGEST_OK) {
+					fprintf(stderr, "%s: %s\n", opts.file_name, suggest_strerror(error));
+					exit(EXIT_FAILURE);
+				}
+				if (error == SUGGEST_PARTIAL) {
+					fprintf(stderr, "%s: %s\n", word, suggest_strerror(error));
+				}
+
+			} else if (opts.shard_list) {
+				int failed = shard_query(&shards, word, &params, callback, user_data);
+				if (failed < 0) {
+					fprintf(stderr, "%s: %s\n", word, suggest_strerror(failed));
+				} else if (failed) {
+					fprintf(stderr, "%s: %d of %d shards did not answer, results are partial\n", word, failed,
+							shards.count);
+				}
+
+			} else if (!opts.cache_file
+				|| !cache_lookup(&cache, dict_hash, word, opts.max_length_diff, opts.max_lev_diff,
+								 &output.data, &output.size)) {
+				if (!ctx) {
+					ctx = open_dict(&opts);
+				}
+				if (!calibrated) {
+					calibrate_dict(ctx, word, &params);
+					calibrated = 1;
+				}
+				if (records) {
+					records->ctx = ctx;
+				}
+				int error = suggest_query(ctx, word, &params, callback, user_data);
+				if (error < SUGGEST_OK) {
+					fprintf(stderr, "%s: %s\n", word, suggest_strerror(error));
+					exit(EXIT_FAILURE);
+				}
+				if (error == SUGGEST_PARTIAL) {
+					fprintf(stderr, "%s: %s\n", word, suggest_strerror(error));
+				} else if (opts.cache_file) {
+					cache_store(&cache, dict_hash, word, opts.max_length_diff, opts.max_lev_diff,
+								output.data, output.size);
+				}
+			}
+
+			output_flush(&output);
 			word_index++;
 		}
+		if (records) {
+			record_flush(records);
+		}
 
 		struct TimePair time_pair;
 		diff_time(before_point, &time_pair);
@@ -76,198 +259,335 @@ int main (const int argc, const char **argv)
 	struct TimePair time_pair;
 	diff_time(start_point, &time_pair);
 	opts.verbose && fprintf(stderr, "Overal execution time: %ld.%09ld s\n", time_pair.sec, time_pair.nano);
-		
-	unload_dict(dict);
+
+	suggest_close(ctx);
+	if (layers) {
+		close_layers(layers, opts.layer_count);
+	}
+	if (opts.cache_file) {
+		cache_close(&cache);
+	}
+	free(records);
+	free(known_words);
 }
 
-// Dict
+struct SuggestContext *open_dict (const struct Options *opts)
+{
+	return open_dict_file(opts, opts->file_name);
+}
 
-size_t load_dict (const char *filename, char **addr, uint8_t parallel_proc_count)
+struct SuggestContext *open_dict_file (const struct Options *opts, const char *file_name)
 {
-	FILE *file = fopen(filename, "r");
-	int fd = open(filename, O_RDONLY);
-	if (fd == -1) {
-		handle_error("open");
+	int error;
+	struct SuggestOptions suggest_opts;
+	suggest_default_options(&suggest_opts);
+	suggest_opts.shared_name = opts->shared_name;
+	suggest_opts.alphabet = opts->alphabet;
+	suggest_opts.costs = opts->costs;
+	struct SuggestContext *ctx = suggest_open(file_name, &suggest_opts, &error);
+	if (!ctx) {
+		fprintf(stderr, "%s: %s\n", file_name, suggest_strerror(error));
+		exit(EXIT_FAILURE);
 	}
+	return ctx;
+}
 
-	struct stat sb;
-	if (fstat(fd, &sb) == -1) {
-		handle_error("fstat");
+struct SuggestLayer *open_layers (const struct Options *opts)
+{
+	struct SuggestLayer *layers = calloc(opts->layer_count, sizeof(*layers));
+	if (!layers) {
+		handle_error("calloc for layers");
 	}
-	size_t file_size = sb.st_size;
-	*addr = (void*)malloc(file_size + sizeof(uint8_t));
-	if (!addr) {
-		handle_error("malloc for dict");
+	for (size_t i = 0; i < opts->layer_count; i++) {
+		layers[i].ctx = open_dict_file(opts, opts->layer_files[i]);
+		if (opts->tombstone_files[i]) {
+			layers[i].tombstones = open_dict_file(opts, opts->tombstone_files[i]);
+		}
 	}
+	return layers;
+}
 
-	char *offsets[parallel_proc_count];
-	for (int i = 0; i < parallel_proc_count; i++) {
-		offsets[i] = *(addr) + sizeof(uint8_t) + (file_size / parallel_proc_count + 1) * i;
+// Times the engines before the first query, unless one is named
+void calibrate_dict (struct SuggestContext *ctx, const char *word, const struct SuggestParams *params)
+{
+	if (params->engine && strcmp(params->engine, "auto")) {
+		return;
+	}
+	int error = suggest_calibrate(ctx, word, params);
+	if (error != SUGGEST_OK) {
+		fprintf(stderr, "%s: %s\n", word, suggest_strerror(error));
+		exit(EXIT_FAILURE);
 	}
+}
 
-	const uint8_t buf_size = 250;
-	uint8_t max_string_length = 0;
-	char buf[buf_size];
-	int line = 0;
-	while (fgets(buf, buf_size, file)) {
-		//fprintf(stderr, "%d\r", line);
-		
-		uint8_t process = line % parallel_proc_count;
-		uint8_t string_length = (uint8_t)strlen(buf);
-		if (string_length == buf_size - 1 && buf[buf_size - 2] != 0x13)
-		{
-			fprintf(stderr, "Is string %d greater than 250 symbols? Aborting\n", line + 1);
-			return 1;
-		} else {
-			while (buf[string_length - 1] == 10 || buf[string_length - 1] == 13) {
-				buf[string_length - 1] = 0;
-				string_length--;
-			}
+void close_layers (struct SuggestLayer *layers, size_t count)
+{
+	for (size_t i = 0; i < count; i++) {
+		suggest_close((struct SuggestContext *)layers[i].ctx);
+		suggest_close((struct SuggestContext *)layers[i].tombstones);
+	}
+	free(layers);
+}
 
-			*offsets[process] = string_length;
-			strcpy((offsets[process] + 1), buf);
-			offsets[process] += 1 + string_length;
-		}
+// Session
 
-		if (max_string_length < string_length) {
-			max_string_length = string_length;
-		}
+void run_session (struct SuggestContext *ctx, const struct SuggestParams *params, struct RecordWriter *records)
+{
+	int error;
+	struct SuggestSession *session = suggest_session_open(ctx, params, &error);
+	if (!session) {
+		fprintf(stderr, "%s\n", suggest_strerror(error));
+		exit(EXIT_FAILURE);
+	}
 
-		line++;
+	// Every line is the input so far: a line extending the previous one only
+	// costs its new characters. Every answer ends with an empty line, records
+	// carry the line number instead.
+	char line[UINT8_MAX + 3];
+	char previous[UINT8_MAX + 1];
+	size_t previous_length = 0;
+	if (records) {
+		records->ctx = ctx;
+		records->query = 0;
 	}
+	for (; fgets(line, sizeof(line), stdin); (void)(records && records->query++)) {
+		size_t length = strcspn(line, "\r\n");
+		struct OutputBuffer output = { NULL, 0, 0 };
 
-	**addr = max_string_length;
+		if (!line[length] && !feof(stdin)) {
+			int c;
+			while ((c = getchar()) != EOF && c != '\n');
+			fprintf(stderr, "%.*s...: too long\n", (int)length, line);
+			suggest_session_reset(session);
+			previous_length = 0;
 
-	
-	for (uint8_t j = 0; j < parallel_proc_count; j++) {
-		offsets[j] = 0;
+		} else {
+			if (length < previous_length || memcmp(line, previous, previous_length)) {
+				suggest_session_reset(session);
+				previous_length = 0;
+			}
+			error = suggest_session_append(session, line + previous_length, length - previous_length,
+										   records ? record_suggestion : output_suggestion,
+										   records ? (void *)records : (void *)&output);
+			if (error != SUGGEST_OK) {
+				fprintf(stderr, "%.*s: %s\n", (int)length, line, suggest_strerror(error));
+			}
+			memcpy(previous, line, length);
+			previous_length = length;
+		}
+
+		if (records) {
+			record_flush(records);
+		} else {
+			output_append(&output, "\n", 1);
+			output_flush(&output);
+		}
 	}
-	
-	return file_size;
+
+	suggest_session_close(session);
 }
 
-void unload_dict (char *addr)
+// Output
+
+void output_append (struct OutputBuffer *output, const char *data, size_t size)
 {
-	free(addr);
+	if (output->size + size > output->capacity) {
+		size_t capacity = output->capacity ? output->capacity : 4096;
+		while (capacity < output->size + size) {
+			capacity *= 2;
+		}
+		char *grown = realloc(output->data, capacity);
+		if (!grown) {
+			handle_error("realloc for output");
+		}
+		output->data = grown;
+		output->capacity = capacity;
+	}
+	memcpy(output->data + output->size, data, size);
+	output->size += size;
 }
 
-void print_closest (const char *dict, size_t dict_size, const char *word, short max_length_diff, short max_lev_diff,
-					short parallel_proc_count)
+void output_flush (struct OutputBuffer *output)
 {
-	size_t word_len = strlen(word);
-	uint8_t max_string_length = *dict;
-	size_t offset = sizeof(uint8_t);
-	const char *data = dict + offset;
-	
-	print_closest_fork(data, max_string_length, dict_size, word_len, word, max_length_diff, max_lev_diff, parallel_proc_count);
+	size_t written = 0;
+	while (written < output->size) {
+		ssize_t r = write(STDOUT_FILENO, output->data + written, output->size - written);
+		if (r == -1) {
+			if (errno == EINTR) continue;
+			handle_error("write");
+		}
+		written += r;
+	}
+	free(output->data);
+	output->data = NULL;
+	output->size = output->capacity = 0;
 }
 
-void print_closest_fork (const char *data, uint8_t max_string_length, size_t dict_size, size_t word_len,
-						 const char *word, short max_length_diff, short max_lev_diff, short parallel_proc_count)
+void output_suggestion (const char *word, size_t word_length, int distance, void *user_data)
 {
-	short children_count = parallel_proc_count;
-	short last_child = 0;
-
-	int pipefd[children_count][2];
-	
-	while (last_child < children_count) {
-
-		if (pipe(pipefd[last_child]))
-		{
-			handle_error("pipe");
-		}
+	char line[sizeof("[-2147483648] :: \n") + UINT8_MAX];
+	int prefix_length = sprintf(line, "[%d] :: ", distance);
+	memcpy(line + prefix_length, word, word_length);
+	line[prefix_length + word_length] = '\n';
+	output_append(user_data, line, prefix_length + word_length + 1);
+}
 
-		pid_t pid = fork();
-		if (pid < 0) {
-			handle_error("fork");
-			
-		} else if (pid == 0) { // child
+// Records
 
-			close(pipefd[last_child][0]);
-			FILE *stream = fdopen(pipefd[last_child][1], "w");
+static void record_push (struct RecordWriter *writer, const char *data, size_t size)
+{
+	struct iovec *last = writer->iov_count ? &writer->iov[writer->iov_count - 1] : NULL;
+	if (last && (const char *)last->iov_base + last->iov_len == data) {
+		last->iov_len += size;
+	} else {
+		writer->iov[writer->iov_count].iov_base = (void *)data;
+		writer->iov[writer->iov_count].iov_len = size;
+		writer->iov_count++;
+	}
+}
 
-			const char *offset = data + sizeof(uint8_t) + (dict_size / parallel_proc_count + 1) * last_child;
+// Copies size bytes into the arena and pushes them
+static void record_copy (struct RecordWriter *writer, const char *data, size_t size)
+{
+	memcpy(writer->arena + writer->arena_size, data, size);
+	record_push(writer, writer->arena + writer->arena_size, size);
+	writer->arena_size += size;
+}
 
-			print_closest_iterations(stream, offset, max_string_length,
-			                         word_len, word, max_length_diff, max_lev_diff);
-			fclose(stream);
-			close(pipefd[last_child][1]);
-			exit(0);
-			
-		} else { // parent
+static void record_put_le (char *out, uint64_t value, int bytes)
+{
+	for (int i = 0; i < bytes; i++) {
+		out[i] = (char)(value >> (8 * i));
+	}
+}
 
-			close(pipefd[last_child][1]);
-			last_child++;
-		}
+/* Binary: uint16 size of the rest of the record, uint32 query, uint8
+ * distance, uint64 dictionary index (all ones when unknown), then the word
+ * bytes; little endian. JSONL: one object per line. Words from the dictionary
+ * are written from where they are, only headers are formatted.
+ */
+// Length of the valid UTF-8 sequence of two to four bytes word starts with, 0
+// if it does not start with one
+static size_t record_utf8_length (const unsigned char *word, size_t length)
+{
+	size_t size = word[0] >= 0xc2 && word[0] <= 0xdf ? 2 : word[0] >= 0xe0 && word[0] <= 0xef ? 3
+		: word[0] >= 0xf0 && word[0] <= 0xf4 ? 4 : 0;
+	if (!size || size > length) {
+		return 0;
 	}
-	
-	// parent only
-	while (1) {
-		int status;
-		pid_t done = wait(&status);
-		if (done == -1) {
-			if (errno == ECHILD) break; // no more child processes
-		} else {
-			if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
-				handle_error("wait");
-			}
+	for (size_t i = 1; i < size; i++) {
+		if ((word[i] & 0xc0) != 0x80) {
+			return 0;
 		}
 	}
-
-	for (int i = 0; i <= last_child - 1; i++) {
-		char buf[255];
-		ssize_t read_bytes;
-		while ((read_bytes = read(pipefd[i][0], &buf, 255)) > 0) {
-			ssize_t write_result = write(STDOUT_FILENO, &buf, read_bytes);
-			assert(write_result == read_bytes);
-		}
+	// Overlong forms, surrogates and code points past U+10FFFF
+	if ((word[0] == 0xe0 && word[1] < 0xa0) || (word[0] == 0xed && word[1] >= 0xa0)
+		|| (word[0] == 0xf0 && word[1] < 0x90) || (word[0] == 0xf4 && word[1] >= 0x90)) {
+		return 0;
 	}
+	return size;
 }
 
-void print_closest_iterations (FILE *stream, const char *offset, uint8_t max_string_length,
-			     			   size_t word_len, const char *word, short max_length_diff, short max_lev_diff)
+void record_suggestion (const char *word, size_t word_length, int distance, void *user_data)
 {
-	// printf("%d\t%d\t%d\t%d\n", getpid(), start, stop, step); // DEBUG
-	size_t* levenstein_buffer = levenstein_init_buffer(max_string_length);
-	size_t local_offset = 0;
-	size_t sizeof_uint8_t = sizeof(uint8_t);
-	while (1) {
-		uint8_t local_word_length = *(offset + local_offset);
-		const char *local_word = offset + local_offset + sizeof_uint8_t;
-		print_closest_segment(stream, levenstein_buffer, local_word, local_word_length, max_string_length, word_len, word, max_length_diff, max_lev_diff);
-
-		local_offset += sizeof_uint8_t + local_word_length;
-
-		if (*(offset + local_offset) == 0) {
-			break;
-		}
+	struct RecordWriter *writer = user_data;
+	if (writer->iov_count + 3 > RECORD_IOV || writer->arena_size + RECORD_MAX > RECORD_ARENA) {
+		record_flush(writer);
 	}
-	levenstein_free_buffer(levenstein_buffer);
-}
 
-void print_closest_segment (FILE *stream, size_t* levenstein_buffer, const char *local_word, uint8_t local_word_length, uint8_t max_string_length, 
-							size_t word_len, const char *word, short max_length_diff, short max_lev_diff)
-{
-	size_t result = -1;
+	int64_t index = writer->ctx ? suggest_word_index(writer->ctx, word) : -1;
+	if (writer->format == OUTPUT_BINARY) {
+		char header[15];
+		record_put_le(header, sizeof(header) - 2 + word_length, 2);
+		record_put_le(header + 2, writer->query, 4);
+		record_put_le(header + 6, (uint8_t)distance, 1);
+		record_put_le(header + 7, index < 0 ? UINT64_MAX : (uint64_t)index, 8);
+		record_copy(writer, header, sizeof(header));
 
-	if (word_len == local_word_length && !strncmp(local_word, word, local_word_length)) {
-		result = 0;
-		
 	} else {
-		
-		if (abs(word_len - local_word_length) <= max_length_diff) {
-			result = levenstein(word, word_len, local_word, local_word_length, levenstein_buffer, max_string_length);
+		char header[sizeof("{\"query\":4294967295,\"distance\":-2147483648,\"index\":-9223372036854775808,\"word\":\"")];
+		int header_length = index < 0
+			? sprintf(header, "{\"query\":%u,\"distance\":%d,\"index\":null,\"word\":\"", writer->query, distance)
+			: sprintf(header, "{\"query\":%u,\"distance\":%d,\"index\":%lld,\"word\":\"", writer->query, distance,
+					  (long long)index);
+		record_copy(writer, header, header_length);
+
+		// Quotes, backslashes, control characters and bytes that are not UTF-8
+		// (words of single-byte code pages) are escaped in a copy, the latter
+		// as the code point of the same value
+		size_t plain = 0, sequence;
+		while (plain < word_length) {
+			unsigned char c = word[plain];
+			if (c >= 0x20 && c < 0x80 && c != '"' && c != '\\') {
+				plain++;
+			} else if (c >= 0x80 && (sequence = record_utf8_length((const unsigned char *)word + plain,
+																   word_length - plain))) {
+				plain += sequence;
+			} else {
+				break;
+			}
+		}
+		if (plain < word_length) {
+			char escaped[RECORD_MAX - sizeof(header)];
+			size_t size = 0;
+			for (size_t i = 0; i < word_length; i++) {
+				unsigned char c = word[i];
+				sequence = c >= 0x80 ? record_utf8_length((const unsigned char *)word + i, word_length - i) : 0;
+				if (c == '"' || c == '\\') {
+					escaped[size++] = '\\';
+					escaped[size++] = c;
+				} else if (sequence) {
+					memcpy(escaped + size, word + i, sequence);
+					size += sequence;
+					i += sequence - 1;
+				} else if (c < 0x20 || c >= 0x80) {
+					size += sprintf(escaped + size, "\\u%04x", c);
+				} else {
+					escaped[size++] = c;
+				}
+			}
+			record_copy(writer, escaped, size);
+			record_push(writer, "\"}\n", 3);
+			return;
 		}
 	}
 
-	if (result >= 0 && result <= max_lev_diff) {
-		char out_buf[local_word_length + 1];
-		strncpy(out_buf, local_word, local_word_length);
-		out_buf[local_word_length] = 0;
-		fprintf(stream, "[%d] :: %s\n", (int)result, out_buf);
+	// Words of a dictionary without the index (a front-coded image) are decoded
+	// for the callback only
+	if (writer->copy_words || (writer->ctx && index < 0)) {
+		record_copy(writer, word, word_length);
+	} else {
+		record_push(writer, word, word_length);
+	}
+	if (writer->format == OUTPUT_JSONL) {
+		record_push(writer, "\"}\n", 3);
 	}
 }
 
+void record_flush (struct RecordWriter *writer)
+{
+	struct iovec *iov = writer->iov;
+	int count = writer->iov_count;
+	while (count) {
+		ssize_t r = writev(STDOUT_FILENO, iov, count);
+		if (r == -1) {
+			if (errno == EINTR) continue;
+			handle_error("writev");
+		}
+		while (count && (size_t)r >= iov->iov_len) {
+			r -= iov->iov_len;
+			iov++;
+			count--;
+		}
+		if (count) {
+			iov->iov_base = (char *)iov->iov_base + r;
+			iov->iov_len -= r;
+		}
+	}
+	writer->iov_count = 0;
+	writer->arena_size = 0;
+}
+
 // Options
 
 void read_opts (const int argc, const char **argv, struct Options *opts)
@@ -282,12 +602,30 @@ void read_opts (const int argc, const char **argv, struct Options *opts)
 			{"lev-diff",      required_argument, 0, 'l'},
 			{"parallel-proc", required_argument, 0, 'p'},
 			{"dict-file",     required_argument, 0, 'd'},
+			{"cache-file",    required_argument, 0, 'c'},
+			{"cache-slots",   required_argument, 0, 'C'},
+			{"serve",         required_argument, 0, 'S'},
+			{"shards",        required_argument, 0, 'H'},
+			{"shard-timeout", required_argument, 0, 'T'},
+			{"complete",      no_argument,       0, 'P'},
+			{"limit",         required_argument, 0, 'n'},
+			{"deadline-us",   required_argument, 0, 'D'},
+			{"stream",        no_argument,       0, 'R'},
+			{"shared",        required_argument, 0, 'M'},
+			{"alphabet",      required_argument, 0, 'L'},
+			{"tombstones",    required_argument, 0, 'X'},
+			{"engine",        required_argument, 0, 'E'},
+			{"session",       no_argument,       0, 'I'},
+			{"exact-first",   no_argument,       0, 'e'},
+			{"damerau",       no_argument,       0, 'A'},
+			{"costs",         required_argument, 0, 'W'},
+			{"format",        required_argument, 0, 'o'},
 			{"help",          no_argument,       0, 'h'},
 			{0, 0, 0, 0}
 		};
 
 		int option_index = 0;
-		int c = getopt_long(argc, (char**)argv, "v:r:s:l:p:d:h", long_options, &option_index);
+		int c = getopt_long(argc, (char**)argv, "v:r:s:l:p:d:c:C:Pn:eo:h", long_options, &option_index);
 
 
 		if (c == -1)
@@ -316,11 +654,106 @@ void read_opts (const int argc, const char **argv, struct Options *opts)
 				break;
 
 			case 'd': /* --dict_file */
-				opts->file_name = optarg;
+				// Every -d is a layer, the later ones take precedence
+				if (!opts->layer_files) {
+					opts->layer_files = calloc(argc, sizeof(*opts->layer_files));
+					opts->tombstone_files = calloc(argc, sizeof(*opts->tombstone_files));
+					if (!opts->layer_files || !opts->tombstone_files) {
+						handle_error("calloc for layers");
+					}
+					opts->file_name = optarg;
+				}
+				opts->layer_files[opts->layer_count++] = optarg;
+				break;
+
+			case 'X': /* --tombstones */
+				if (!opts->layer_count) {
+					fprintf(stderr, "--tombstones applies to the -d before it\n");
+					exit(1);
+				}
+				opts->tombstone_files[opts->layer_count - 1] = optarg;
+				opts->layered = 1;
+				break;
+
+			case 'c': /* --cache-file */
+				opts->cache_file = optarg;
+				break;
+
+			case 'C': /* --cache-slots */
+				opts->cache_slots = (uint32_t)atoi(optarg);
+				break;
+
+			case 'S': /* --serve */
+				opts->serve_socket = optarg;
+				break;
+
+			case 'H': /* --shards */
+				opts->shard_list = optarg;
+				break;
+
+			case 'T': /* --shard-timeout */
+				opts->shard_timeout_ms = atoi(optarg);
+				break;
+
+			case 'P': /* --complete */
+				opts->complete = 1;
+				break;
+
+			case 'n': /* --limit */
+				opts->limit = atoi(optarg);
+				break;
+
+			case 'D': /* --deadline-us */
+				opts->deadline_us = atol(optarg);
+				break;
+
+			case 'R': /* --stream */
+				opts->stream = 1;
+				break;
+
+			case 'M': /* --shared */
+				opts->shared_name = optarg;
+				break;
+
+			case 'L': /* --alphabet */
+				opts->alphabet = optarg;
+				break;
+
+			case 'E': /* --engine */
+				opts->engine = optarg;
+				break;
+
+			case 'I': /* --session */
+				opts->session = 1;
+				break;
+
+			case 'e': /* --exact-first */
+				opts->exact_first = 1;
+				break;
+
+			case 'A': /* --damerau */
+				opts->damerau = 1;
+				break;
+
+			case 'W': /* --costs */
+				opts->costs = optarg;
+				break;
+
+			case 'o': /* --format */
+				if (!strcmp(optarg, "text")) {
+					opts->format = OUTPUT_TEXT;
+				} else if (!strcmp(optarg, "jsonl")) {
+					opts->format = OUTPUT_JSONL;
+				} else if (!strcmp(optarg, "binary")) {
+					opts->format = OUTPUT_BINARY;
+				} else {
+					fprintf (stderr, "Unknown output format %s\n", optarg);
+					exit(1);
+				}
 				break;
 
 			case 'h': /* --help */
-				printf ("Usage: %s [-s max_strlen_diff] [-l max_levenstein_diff] [-p parallel_proc_count] [-r runs] [-d dict_file] word | -h\n", argv[0]);
+				printf ("Usage: %s [-s max_strlen_diff] [-l max_levenstein_diff] [-p parallel_proc_count] [-r runs] [-d dict_file [--tombstones file]]... [-c cache_file [-C cache_slots]] [--shards socket,... [--shard-timeout ms]] [-P [-n limit]] [-e] [--deadline-us us] [--stream] [--shared name] [--alphabet name] [--engine name] [--damerau] [--costs file] [-o text|jsonl|binary] word | --session | --serve socket | -h\n", argv[0]);
 				exit(0);
 				break;
 
@@ -333,7 +766,47 @@ void read_opts (const int argc, const char **argv, struct Options *opts)
 		}
 	}
 	
-	if (optind < argc)
+	if (opts->cache_file && (opts->shard_list || opts->complete || opts->format != OUTPUT_TEXT)) {
+		fprintf (stderr, "The result cache is not available with --shards, --complete and -o\n");
+		exit(1);
+	}
+	if (opts->stream && (opts->cache_file || opts->shard_list || opts->complete || opts->serve_socket)) {
+		fprintf (stderr, "--stream scans the word list for every query and cannot be combined with -c, --shards, --complete or --serve\n");
+		exit(1);
+	}
+	if (opts->exact_first && (opts->shard_list || opts->stream || opts->complete)) {
+		fprintf (stderr, "-e is not available with --shards, --stream and --complete\n");
+		exit(1);
+	}
+	if (opts->damerau && (opts->cache_file || opts->shard_list || opts->complete || opts->session)) {
+		fprintf (stderr, "--damerau is not available with -c, --shards, --complete and --session\n");
+		exit(1);
+	}
+	if (opts->costs && (opts->cache_file || opts->shard_list || opts->complete || opts->stream || opts->session
+						|| opts->damerau)) {
+		fprintf (stderr, "--costs is not available with -c, --shards, --complete, --stream, --session and --damerau\n");
+		exit(1);
+	}
+	if (opts->alphabet && (opts->cache_file || opts->shard_list || opts->stream)) {
+		fprintf (stderr, "--alphabet is not available with -c, --shards and --stream\n");
+		exit(1);
+	}
+	opts->layered |= opts->layer_count > 1;
+	if (opts->layered && (opts->cache_file || opts->shard_list || opts->complete || opts->stream || opts->shared_name
+						  || opts->serve_socket || opts->session)) {
+		fprintf (stderr, "Several -d and --tombstones are not available with -c, --shards, --complete, --stream, --shared, --serve and --session\n");
+		exit(1);
+	}
+	if (opts->shard_list && opts->complete) {
+		fprintf (stderr, "--complete needs a local dictionary\n");
+		exit(1);
+	}
+
+	if (opts->serve_socket || opts->session) {
+		opts->words = NULL;
+		opts->words_count = 0;
+
+	} else if (optind < argc)
 	{
 		int i = 0;
 		int words_count = argc - optind;
@@ -344,10 +817,11 @@ void read_opts (const int argc, const char **argv, struct Options *opts)
 		}
 		words[words_count] = NULL;
 		opts->words = words;
+		opts->words_count = words_count;
 		
 	} else {
 		fprintf (stderr, "One or more words is required!\n");
-		printf ("Usage: %s [-s max_strlen_diff] [-l max_levenstein_diff] [-p parallel_proc_count] [-r runs] [-d dict_file] word | -h\n", argv[0]);
+		printf ("Usage: %s [-s max_strlen_diff] [-l max_levenstein_diff] [-p parallel_proc_count] [-r runs] [-d dict_file [--tombstones file]]... [-c cache_file [-C cache_slots]] [--shards socket,... [--shard-timeout ms]] [-P [-n limit]] [-e] [--deadline-us us] [--stream] [--shared name] [--alphabet name] [--engine name] [--damerau] [--costs file] [-o text|jsonl|binary] word | --session | --serve socket | -h\n", argv[0]);
 		exit(1);
 	}
 }
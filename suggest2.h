@@ -38,12 +38,14 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/mman.h>
+#include <sys/uio.h>
 #include <string.h>
 #include <strings.h>
 #include <getopt.h>
 #include <sys/wait.h>
 #include <time.h>
 #include <errno.h>
+#include <stdint.h>
 
 // Types
 #ifndef _INTTYPES_H
@@ -51,23 +53,44 @@ typedef unsigned char uint8_t;
 #endif
 
 // Dependencies
-#include "levenstein.h"
+#include "libsuggest.h"
+#include "cache.h"
+#include "shard.h"
 
 // Service
 #define handle_error(msg) \
 	do { perror(msg); exit(EXIT_FAILURE); } while (0)
 
-// Dict
-size_t load_dict (const char *filename, char **addr, uint8_t parallel_proc_count);
-void unload_dict (char *addr);
-void print_closest (const char *dict, size_t dict_size, const char *word, short max_length_diff, short max_lev_diff,
-					short parallel_proc_count);
-void print_closest_fork (const char *data, uint8_t max_string_length, size_t dict_size, size_t word_len,
-						 const char *word, short max_length_diff, short max_lev_diff, short parallel_proc_count);
-void print_closest_iterations (FILE *stream, const char *offset, uint8_t max_string_length,
-                               size_t word_len, const char *word, short max_length_diff, short max_lev_diff);
-void print_closest_segment (FILE *stream, size_t* levenstein_buffer, const char *local_word, uint8_t local_word_length,
-							uint8_t max_string_length, size_t word_len, const char *word, short max_length_diff, short max_lev_diff);
+// Output
+struct OutputBuffer {
+	char *data;
+	size_t size;
+	size_t capacity;
+};
+void output_append (struct OutputBuffer *output, const char *data, size_t size);
+void output_flush (struct OutputBuffer *output);
+void output_suggestion (const char *word, size_t word_length, int distance, void *user_data);
+
+// Machine output: one record per suggestion, gathered into an iovec batch
+// and written with writev() when the batch is full or flushed
+#define OUTPUT_TEXT 0
+#define OUTPUT_JSONL 1
+#define OUTPUT_BINARY 2
+#define RECORD_IOV 1024     // Linux IOV_MAX
+#define RECORD_ARENA 65536
+#define RECORD_MAX 2048     // room for one record in the arena, escaped word included
+struct RecordWriter {
+	uint8_t format;
+	const struct SuggestContext *ctx; // dictionary the words come from, NULL when they have no index
+	uint8_t copy_words;               // words are only valid during the callback
+	uint32_t query;
+	struct iovec iov[RECORD_IOV];
+	int iov_count;
+	char arena[RECORD_ARENA];         // record headers (and copied words) of the batch
+	size_t arena_size;
+};
+void record_suggestion (const char *word, size_t word_length, int distance, void *user_data);
+void record_flush (struct RecordWriter *writer);
 
 // Options
 struct Options {
@@ -77,9 +100,39 @@ struct Options {
 	short max_lev_diff;
 	uint8_t parallel_proc_count;
 	char *file_name;
+	const char **layer_files;     // every -d, the first one is file_name
+	const char **tombstone_files; // --tombstones of each layer, NULL for none
+	size_t layer_count;
+	uint8_t layered;              // several -d or --tombstones: queried with suggest_query_layers()
+	char *cache_file;
+	uint32_t cache_slots;
+	char *serve_socket;
+	char *shard_list;
+	int shard_timeout_ms;
+	uint8_t complete;
+	size_t limit;
+	long deadline_us;
+	uint8_t stream;
+	char *shared_name;
+	const char *alphabet;
+	char *engine;
+	uint8_t session;
+	uint8_t exact_first;
+	uint8_t damerau;
+	const char *costs;
+	uint8_t format;
 	const char **words;
+	size_t words_count;
 };
 void read_opts (const int argc, const char **argv, struct Options *opts);
+struct SuggestContext *open_dict (const struct Options *opts);
+struct SuggestContext *open_dict_file (const struct Options *opts, const char *file_name);
+struct SuggestLayer *open_layers (const struct Options *opts);
+void close_layers (struct SuggestLayer *layers, size_t count);
+void calibrate_dict (struct SuggestContext *ctx, const char *word, const struct SuggestParams *params);
+
+// Session
+void run_session (struct SuggestContext *ctx, const struct SuggestParams *params, struct RecordWriter *records);
 
 // Timer
 struct TimePair {
@@ -1,3 +1,228 @@
 #!/bin/bash
-# Encoding: cp1251
-./suggest2 -v1 -r10 -p4 -s2 -l4 -d files/dict_ansi 
+# Compares every query mode of suggest2 with the classic engine over a small
+# generated word list. Run from the source directory after make.
+
+cd "$(dirname "$0")"
+dir=$(mktemp -d)
+shm=suggest2-test-$$
+pids=
+trap 'kill $pids 2>/dev/null; rm -rf "$dir"; rm -f /dev/shm/$shm' EXIT
+failed=0
+
+# Words of 1 to 10 letters out of 6, so that most queries have neighbours at
+# every distance; unique, with a frequency
+awk 'BEGIN {
+	srand(7)
+	while (count < 3000) {
+		length_ = 1 + int(rand() * 10)
+		word = ""
+		for (i = 0; i < length_; i++) word = word substr("abcdef", 1 + int(rand() * 6), 1)
+		if (!(word in seen)) { seen[word] = 1; count++; print word "\t" int(rand() * 1000) }
+	}
+}' > $dir/words
+
+queries="a ab abc abcd abcdef fedcba aaaaaaaa bcdefabc cafe deadbeef ffff"
+settings="0:0 1:1 2:2 3:2 4:3 5:5 9:9"
+
+./dict-build -f image < $dir/words > $dir/words.img 2>/dev/null
+./dict-build -f image -n 2 -o $dir/shard < $dir/words 2>/dev/null
+./dict-build -f compact < $dir/words > $dir/words.z 2>/dev/null
+printf 'unit 1\n' > $dir/unit
+printf '# neighbours cost half an edit, a and b are interchangeable\nunit 2\na b 0\nc d 1\nd e 1\n' > $dir/costs
+
+# Prints sorted suggestions of suggest2 run with its arguments
+suggest () {
+	./suggest2 "$@" 2>/dev/null | grep -v '^$' | sort
+}
+
+# check name reference... -- candidate...
+check () {
+	local name=$1
+	shift
+	local reference=() candidate=()
+	while [ "$1" != "--" ]; do reference+=("$1"); shift; done
+	shift
+	candidate=("$@")
+	if ! cmp -s <(suggest "${reference[@]}") <(suggest "${candidate[@]}"); then
+		echo "FAIL $name: ${candidate[*]}"
+		failed=1
+	fi
+}
+
+for setting in $settings; do
+	l=${setting%:*}
+	s=${setting#*:}
+	for word in $queries; do
+		classic=(-d $dir/words -l$l -s$s --engine classic $word)
+		if [ $l -le 8 ]; then
+			check "bounded" "${classic[@]}" -- -d $dir/words -l$l -s$s --engine bounded $word
+		fi
+		check "image" "${classic[@]}" -- -d $dir/words.img -l$l -s$s $word
+		check "deadline" "${classic[@]}" -- -d $dir/words.img -l$l -s$s --deadline-us 10000000 $word
+		check "compact" "${classic[@]}" -- -d $dir/words.z -l$l -s$s $word
+		check "stream" "${classic[@]}" -- -d $dir/words -l$l -s$s --stream $word
+		check "columnar" "${classic[@]}" -- -d $dir/words -l$l -s$s --engine columnar $word
+		check "image columnar" "${classic[@]}" -- -d $dir/words.img -l$l -s$s --engine columnar $word
+		check "shared" "${classic[@]}" -- -d $dir/words --shared $shm -l$l -s$s $word
+		check "auto" "${classic[@]}" -- -d $dir/words -l$l -s$s -p1 $word
+		check "session" "${classic[@]}" -- -d $dir/words.img -l$l -s$s --session < <(echo $word)
+
+		osa=(-d $dir/words -l$l -s$s --damerau --engine classic $word)
+		check "damerau" "${osa[@]}" -- -d $dir/words.img -l$l -s$s --damerau --engine columnar $word
+		if [ $l -le 8 ]; then
+			check "damerau bounded" "${osa[@]}" -- -d $dir/words.img -l$l -s$s --damerau --engine bounded $word
+		fi
+
+		# Unit costs are the levenstein distance
+		check "costs unit 1" "${classic[@]}" -- -d $dir/words.img -l$l -s$s --costs $dir/unit $word
+		weighted=(-d $dir/words -l$l -s$s --costs $dir/costs --engine classic $word)
+		check "costs columnar" "${weighted[@]}" -- -d $dir/words.img -l$l -s$s --costs $dir/costs --engine columnar $word
+		check "costs compact" "${weighted[@]}" -- -d $dir/words.z -l$l -s$s --costs $dir/costs $word
+
+		check "cache miss" "${classic[@]}" -- -d $dir/words -c $dir/cache -l$l -s$s $word
+		check "cache hit" "${classic[@]}" -- -d $dir/words -c $dir/cache -l$l -s$s $word
+	done
+done
+
+# The engine calibrated on a dictionary large enough for it answers the same
+awk 'BEGIN {
+	srand(11)
+	for (count = 0; count < 100000; count++) {
+		length_ = 4 + int(rand() * 7)
+		word = ""
+		for (i = 0; i < length_; i++) word = word substr("abcdefghij", 1 + int(rand() * 10), 1)
+		print word
+	}
+}' > $dir/large
+for word in abcd hijabcde; do
+	check "calibrated" -d $dir/large -l2 -s6 --engine classic $word -- -d $dir/large -l2 -s6 $word
+	check "calibrated damerau" -d $dir/large -l2 -s6 --damerau --engine classic $word \
+		-- -d $dir/large -l2 -s6 --damerau $word
+done
+
+# A swap of two adjacent letters is one edit with --damerau
+printf 'ba\nbca\n' > $dir/swap
+if [ "$(suggest -d $dir/swap -l1 --damerau ab)" != "[1] :: ba" ]; then
+	echo "FAIL damerau swap"
+	failed=1
+fi
+
+# Shards answer the union of the shard dictionaries
+for shard in 0 1; do
+	./suggest2 -d $dir/shard.$shard --serve $dir/socket.$shard 2>/dev/null &
+	pids="$pids $!"
+done
+for attempt in 1 2 3 4 5 6 7 8 9 10; do
+	[ -S $dir/socket.0 ] && [ -S $dir/socket.1 ] && break
+	sleep 0.2
+done
+for word in $queries; do
+	check "shards" -d $dir/words -l2 -s2 --engine classic $word -- --shards $dir/socket.0,$dir/socket.1 -l2 -s2 $word
+done
+
+# An image whose first word does not have the length of its partition is
+# refused (the data starts right after the 312 byte header, 64 byte aligned)
+cp $dir/words.img $dir/bad.img
+printf '\377' | dd of=$dir/bad.img bs=1 seek=320 conv=notrunc 2>/dev/null
+if ./suggest2 -d $dir/bad.img -l1 abc > /dev/null 2>&1; then
+	echo "FAIL malformed image"
+	failed=1
+fi
+
+# So is an image whose first block does not start at the first word (the
+# block section is the eighth of the section table, at 56 in the header)
+blocks=$(od -An -t u8 -j $((56 + 16 * 7)) -N 8 $dir/words.img)
+cp $dir/words.img $dir/bad.img
+printf '\377' | dd of=$dir/bad.img bs=1 seek=$((blocks + 16)) conv=notrunc 2>/dev/null
+if ./suggest2 -d $dir/bad.img -l1 abc > /dev/null 2>&1; then
+	echo "FAIL malformed block"
+	failed=1
+fi
+
+# Completions: the first n of a longer list, for a limit kept while searching,
+# and words listed twice are completed once
+head -500 $dir/words | cat - $dir/words > $dir/repeated
+for word in a ab cafe; do
+	for l in 0 1 2; do
+		if ! cmp -s <(./suggest2 -d $dir/words.img -P -n 5 -l$l $word) \
+			<(./suggest2 -d $dir/words.img -P -n 100000 -l$l $word | head -5); then
+			echo "FAIL completion limit: -P -l$l $word"
+			failed=1
+		fi
+		if ! cmp -s <(./suggest2 -d $dir/words -P -n 100000 -l$l $word) \
+			<(./suggest2 -d $dir/repeated -P -n 100000 -l$l $word); then
+			echo "FAIL completion repeated: -P -l$l $word"
+			failed=1
+		fi
+	done
+done
+
+# A word of the dictionary is answered alone with -e, others are searched
+for word in $queries; do
+	if cut -f1 $dir/words | grep -q -x -e $word; then
+		if [ "$(suggest -d $dir/words.img -e -l2 -s2 $word)" != "[0] :: $word" ]; then
+			echo "FAIL exact: $word"
+			failed=1
+		fi
+	else
+		check "exact" -d $dir/words.img -l2 -s2 --engine classic $word -- -d $dir/words.img -e -l2 -s2 $word
+	fi
+done
+
+# Layers split out of the list give the suggestions of the whole list, and a
+# word of any layer is known to -e
+head -1500 $dir/words > $dir/first
+tail -n +1501 $dir/words | ./dict-build -f image > $dir/second.img 2>/dev/null
+for word in $queries; do
+	check "layers" -d $dir/words -l2 -s2 --engine classic $word -- -d $dir/first -d $dir/second.img -l2 -s2 $word
+done
+known=$(for word in abc cafe; do cut -f1 $dir/words | grep -x -e $word; done | wc -l)
+if [ "$(./suggest2 -d $dir/second.img -d $dir/first -e -l2 -s2 abc cafe | grep -c '^\[0\]')" != $known ]; then
+	echo "FAIL layers exact"
+	failed=1
+fi
+
+# Looking all the words of the command line up together answers each of them
+# as it is answered alone
+if ! cmp -s <(./suggest2 -d $dir/words.img -e -l2 -s2 $queries) \
+	<(for word in $queries; do ./suggest2 -d $dir/words.img -e -l2 -s2 $word; done); then
+	echo "FAIL exact batch"
+	failed=1
+fi
+
+# JSONL records carry the same suggestions as the text lines, and bytes that
+# are not UTF-8 are escaped
+for word in $queries; do
+	if ! cmp -s <(suggest -d $dir/words.img -l2 -s2 $word) <(./suggest2 -d $dir/words.img -l2 -s2 -o jsonl $word \
+		| sed -E 's/^\{"query":0,"distance":([0-9]+),"index":[0-9]+,"word":"(.*)"\}$/[\1] :: \2/' | sort); then
+		echo "FAIL jsonl: $word"
+		failed=1
+	fi
+done
+printf 'caf\351\n' > $dir/latin1
+if ! ./suggest2 -d $dir/latin1 -l1 -o jsonl cafe | grep -q -F '"word":"caf\u00e9"'; then
+	echo "FAIL jsonl escape"
+	failed=1
+fi
+
+# An alphabet folds case and counts a multibyte character as one edit, in a
+# word list as in an image
+printf 'Straße\t3\nstrasse\t2\nПривет\t5\nпривет\t9\nМир\t1\nmir\t4\nÉté\t2\nete\t1\n' > $dir/utf8
+./dict-build -f image -a utf8 < $dir/utf8 > $dir/utf8.img 2> /dev/null
+for word in привет ПРИВЕТ strasse STRASSE ete ÉTÉ мир; do
+	check "alphabet" -d $dir/utf8 --alphabet utf8 -l1 -s1 --engine classic $word -- -d $dir/utf8.img -l1 -s1 $word
+done
+if [ "$(suggest -d $dir/utf8.img -l0 -s0 ПРИВЕТ)" != "[0] :: привет" ]; then
+	echo "FAIL alphabet fold"
+	failed=1
+fi
+
+# Distances are reported in a byte: longer queries and larger thresholds are refused
+long=$(printf 'a%.0s' $(seq 300))
+if ./suggest2 -d $dir/words -l2 $long > /dev/null 2>&1 || ./suggest2 -d $dir/words -l255 abc > /dev/null 2>&1; then
+	echo "FAIL query limits"
+	failed=1
+fi
+
+[ $failed = 0 ] && echo "ALL OK"
+exit $failed